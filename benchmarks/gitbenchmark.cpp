@@ -0,0 +1,223 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "gitbenchmark.h"
+#include "repogenerator.h"
+#include "settings.h"
+#include "commitfilter.h"
+#include "commitindex.h"
+#include "diffrenderer.h"
+#include "flagdatabase.h"
+#include "historywalker.h"
+#include "itembuilder.h"
+
+#include <KGlobal>
+#include <KTempDir>
+#include <qtest_kde.h>
+
+#include <QBuffer>
+#include <QTest>
+
+#include <git2/refs.h>
+#include <git2/commit.h>
+#include <git2/threads.h>
+#include <git2/repository.h>
+
+enum {
+  IncrementalDepth = 50, // commits behind each head the last sync was
+  RenderCount = 200      // commits rendered per iteration
+};
+
+static const char *const BenchmarkIdentifier = "akonadi_git_benchmark";
+
+void GitBenchmark::initTestCase()
+{
+  git_threads_init();
+  m_tempDir = new KTempDir();
+  m_settings = new GitSettings( KGlobal::config() );
+  m_repository = 0;
+
+  const RepoGenerator::Options options = RepoGenerator::Options::fromEnvironment();
+  qDebug() << "Generating" << options.commits << "commits on" << options.branches << "branches,"
+           << options.files << "files," << options.filesPerCommit << "files per commit,"
+           << options.diffLines << "lines per change";
+  RepoGenerator generator( options );
+  QVERIFY2( generator.generate( m_tempDir->name() ), qPrintable( generator.errorString() ) );
+  m_branches = generator.branches();
+
+  QCOMPARE( git_repository_open( &m_repository, QFile::encodeName( m_tempDir->name() + QLatin1String( ".git" ) ) ), int( GIT_OK ) );
+  foreach( const QString &branch, m_branches ) {
+    git_oid oid;
+    const QByteArray refName = "refs/remotes/origin/" + branch.toLatin1();
+    QCOMPARE( git_reference_name_to_id( &oid, m_repository, refName.constData() ), int( GIT_OK ) );
+    m_heads << oid;
+
+    git_commit *commit = 0;
+    QCOMPARE( git_commit_lookup( &commit, m_repository, &oid ), int( GIT_OK ) );
+    for ( int i = 0; i < IncrementalDepth && git_commit_parentcount( commit ) > 0; ++i ) {
+      git_commit *parent = 0;
+      QCOMPARE( git_commit_parent( &parent, commit, 0 ), int( GIT_OK ) );
+      git_commit_free( commit );
+      commit = parent;
+    }
+    m_knownHeads << *git_commit_id( commit );
+    git_commit_free( commit );
+  }
+
+  walk( 0, false, &m_commits );
+  QVERIFY( !m_commits.isEmpty() );
+}
+
+void GitBenchmark::cleanupTestCase()
+{
+  git_repository_free( m_repository );
+  delete m_settings;
+  delete m_tempDir;
+  git_threads_shutdown();
+}
+
+void GitBenchmark::walk( CommitIndex *index, bool incremental, GitJob::CommitList *commits )
+{
+  const CommitFilter filter( m_settings );
+  HistoryWalker walker( m_repository, filter, 0, index );
+  for ( int i = 0; i < m_heads.count(); ++i ) {
+    QVERIFY( walker.addHead( m_heads.at( i ), i ) );
+    if ( incremental )
+      QVERIFY( walker.addKnownHead( m_knownHeads.at( i ), i ) );
+  }
+  while ( !walker.atEnd() )
+    QVERIFY2( walker.walk( commits, 500 ), qPrintable( walker.errorString() ) );
+}
+
+void GitBenchmark::walkAll()
+{
+  QBENCHMARK {
+    GitJob::CommitList commits;
+    walk( 0, false, &commits );
+  }
+}
+
+void GitBenchmark::walkIndexed()
+{
+  // The first walk fills the index, the timed ones are served from it
+  CommitIndex index( m_tempDir->name() + QLatin1String( "index/" ) );
+  GitJob::CommitList commits;
+  walk( &index, false, &commits );
+
+  QBENCHMARK {
+    commits.clear();
+    walk( &index, false, &commits );
+  }
+  QCOMPARE( commits.count(), m_commits.count() );
+}
+
+void GitBenchmark::walkIncremental()
+{
+  QBENCHMARK {
+    GitJob::CommitList commits;
+    walk( 0, true, &commits );
+  }
+}
+
+void GitBenchmark::envelopeConversion()
+{
+  // What listing hands to Akonadi for each commit
+  FlagDatabase database( QLatin1String( BenchmarkIdentifier ) );
+  ItemBuilder builder( &database );
+  builder.setIdentity( QLatin1String( "Benchmark <benchmark@example.org>" ) );
+
+  Akonadi::Item::List items;
+  QBENCHMARK {
+    items.clear();
+    for ( int i = 0; i < m_commits.count(); ++i )
+      items << builder.envelope( m_commits, i );
+  }
+  QCOMPARE( items.count(), m_commits.count() );
+}
+
+void GitBenchmark::itemConversion()
+{
+  // Full messages, as retrieveItem() builds them from rendered commits
+  DiffRenderer renderer( m_repository );
+  const int count = qMin( int( RenderCount ), m_commits.count() );
+  QList<QByteArray> bodies;
+  for ( int i = 0; i < count; ++i ) {
+    git_commit *commit = 0;
+    QCOMPARE( git_commit_lookup( &commit, m_repository, &m_commits.at( i ).oid ), int( GIT_OK ) );
+    QByteArray body;
+    QBuffer buffer( &body );
+    buffer.open( QIODevice::WriteOnly );
+    QVERIFY( renderer.render( commit, &buffer ) );
+    git_commit_free( commit );
+    bodies << body;
+  }
+
+  FlagDatabase database( QLatin1String( BenchmarkIdentifier ) );
+  ItemBuilder builder( &database );
+  builder.setIdentity( QLatin1String( "Benchmark <benchmark@example.org>" ) );
+  QBENCHMARK {
+    for ( int i = 0; i < count; ++i )
+      QVERIFY( builder.item( m_commits, i, bodies.at( i ) ).hasPayload() );
+  }
+}
+
+void GitBenchmark::flagLookup()
+{
+  FlagDatabase database( QLatin1String( BenchmarkIdentifier ) );
+  QVERIFY( database.clear() );
+
+  // A quarter of the commits were read
+  QStringList seen;
+  for ( int i = 0; i < m_commits.count(); i += 4 )
+    seen << m_commits.sha1( i );
+  QVERIFY( database.changeFlags( seen, Akonadi::Item::Flags() << "\\SEEN", Akonadi::Item::Flags() ) );
+
+  int flagged = 0;
+  QBENCHMARK {
+    flagged = 0;
+    for ( int i = 0; i < m_commits.count(); ++i )
+      flagged += database.flags( m_commits.at( i ).oid ).count();
+  }
+  QCOMPARE( flagged, seen.count() );
+  database.clear();
+}
+
+void GitBenchmark::render()
+{
+  DiffRenderer renderer( m_repository );
+  renderer.setLimits( qint64( m_settings->diffBudget() ) * 1024, qint64( m_settings->fileDiffBudget() ) * 1024 );
+  renderer.setGeneratedFilePatterns( m_settings->generatedFilePatterns() );
+  const int count = qMin( int( RenderCount ), m_commits.count() );
+  QBENCHMARK {
+    for ( int i = 0; i < count; ++i ) {
+      git_commit *commit = 0;
+      QCOMPARE( git_commit_lookup( &commit, m_repository, &m_commits.at( i ).oid ), int( GIT_OK ) );
+      QByteArray body;
+      QBuffer buffer( &body );
+      buffer.open( QIODevice::WriteOnly );
+      QVERIFY2( renderer.render( commit, &buffer ), qPrintable( renderer.errorString() ) );
+      git_commit_free( commit );
+    }
+  }
+}
+
+QTEST_KDEMAIN_CORE( GitBenchmark )
+
+#include "gitbenchmark.moc"
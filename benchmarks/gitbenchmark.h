@@ -0,0 +1,67 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#ifndef GIT_BENCHMARK_H_
+#define GIT_BENCHMARK_H_
+
+#include "gitjob.h"
+
+#include <QObject>
+#include <QStringList>
+#include <QVector>
+
+#include <git2/types.h>
+#include <git2/oid.h>
+
+class CommitIndex;
+class GitSettings;
+class KTempDir;
+
+/**
+ * Times the resource's hot paths on a generated repository. See RepoGenerator
+ * for the environment variables that size it.
+ */
+class GitBenchmark : public QObject {
+  Q_OBJECT
+private Q_SLOTS:
+  void initTestCase();
+  void cleanupTestCase();
+
+  void walkAll();
+  void walkIndexed();
+  void walkIncremental();
+  void envelopeConversion();
+  void itemConversion();
+  void flagLookup();
+  void render();
+
+private:
+  void walk( CommitIndex *index, bool incremental, GitJob::CommitList *commits );
+
+  KTempDir *m_tempDir;
+  GitSettings *m_settings;
+  git_repository *m_repository;
+  QStringList m_branches;
+  QVector<git_oid> m_heads;
+  QVector<git_oid> m_knownHeads; // some commits behind m_heads, as after a fetch
+  GitJob::CommitList m_commits; // everything, newest first
+};
+
+#endif
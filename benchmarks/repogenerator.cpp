@@ -0,0 +1,256 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "repogenerator.h"
+
+#include <QFile>
+#include <QVector>
+
+#include <git2/oid.h>
+#include <git2/blob.h>
+#include <git2/tree.h>
+#include <git2/refs.h>
+#include <git2/commit.h>
+#include <git2/errors.h>
+#include <git2/signature.h>
+#include <git2/repository.h>
+
+enum {
+  BaseTime = 1356998400, // 2013-01-01, so the resource's From date doesn't cut anything
+  InitialLines = 40,     // per file
+  Authors = 8
+};
+
+namespace {
+  // The same numbers on every platform, unlike qrand()
+  class Random {
+  public:
+    explicit Random( unsigned int seed ) : m_state( seed ) {}
+
+    int next( int bound )
+    {
+      m_state = m_state * 1103515245u + 12345u;
+      return int( ( m_state >> 8 ) % unsigned( bound ) );
+    }
+
+  private:
+    unsigned int m_state;
+  };
+
+  struct Branch {
+    Branch() : hasHead( false ) {}
+
+    QString name;
+    git_oid head;
+    bool hasHead;
+    QVector<QByteArray> files;
+    QVector<git_oid> blobs;
+  };
+}
+
+static QString lastGitError( const char *what )
+{
+  const git_error *error = giterr_last();
+  return QString::fromLatin1( what ) + QLatin1String( ": " ) +
+         ( error ? QString::fromUtf8( error->message ) : QLatin1String( "unknown error" ) );
+}
+
+static QByteArray fileName( int index )
+{
+  return "file" + QByteArray::number( index ).rightJustified( 4, '0' ) + ".txt";
+}
+
+static void insertLines( QByteArray *content, int position, const QByteArray &lines )
+{
+  int offset = 0;
+  for ( int i = 0; i < position && offset < content->size(); ++i ) {
+    offset = content->indexOf( '\n', offset );
+    offset = offset == -1 ? content->size() : offset + 1;
+  }
+  content->insert( offset, lines );
+}
+
+static int envValue( const char *name, int defaultValue )
+{
+  const QByteArray value = qgetenv( name );
+  bool ok = false;
+  const int result = value.toInt( &ok );
+  return ok && result > 0 ? result : defaultValue;
+}
+
+RepoGenerator::Options::Options() : commits( 2000 )
+                                  , branches( 4 )
+                                  , files( 100 )
+                                  , filesPerCommit( 3 )
+                                  , diffLines( 20 )
+                                  , seed( 1 )
+{
+}
+
+RepoGenerator::Options RepoGenerator::Options::fromEnvironment()
+{
+  Options options;
+  options.commits = envValue( "BENCHMARK_COMMITS", options.commits );
+  options.branches = qMin( envValue( "BENCHMARK_BRANCHES", options.branches ), 32 );
+  options.files = envValue( "BENCHMARK_FILES", options.files );
+  options.filesPerCommit = envValue( "BENCHMARK_FILES_PER_COMMIT", options.filesPerCommit );
+  options.diffLines = envValue( "BENCHMARK_DIFF_LINES", options.diffLines );
+  return options;
+}
+
+RepoGenerator::RepoGenerator( const Options &options ) : m_options( options )
+{
+}
+
+bool RepoGenerator::generate( const QString &path )
+{
+  m_branches.clear();
+  m_errorString.clear();
+
+  git_repository *repository = 0;
+  if ( git_repository_init( &repository, QFile::encodeName( path ).constData(), 0 ) != GIT_OK ) {
+    m_errorString = lastGitError( "git_repository_init" );
+    return false;
+  }
+
+  Random random( m_options.seed );
+  QVector<Branch> branches( 1 );
+  branches[0].name = QLatin1String( "master" );
+  for ( int i = 0; i < m_options.files; ++i ) {
+    QByteArray content;
+    for ( int line = 0; line < InitialLines; ++line )
+      content += "Line " + QByteArray::number( line ) + " of " + fileName( i ) + '\n';
+    git_oid blob;
+    if ( git_blob_create_frombuffer( &blob, repository, content.constData(), content.size() ) != GIT_OK ) {
+      m_errorString = lastGitError( "git_blob_create_frombuffer" );
+      git_repository_free( repository );
+      return false;
+    }
+    branches[0].files << content;
+    branches[0].blobs << blob;
+  }
+
+  git_time_t time = BaseTime;
+  for ( int i = 0; i < m_options.commits && m_errorString.isEmpty(); ++i ) {
+    time += 60 + random.next( 3600 );
+
+    // Branches fork off master over the first half of the history
+    const int forkAt = branches.count() * m_options.commits / ( 2 * m_options.branches );
+    if ( branches.count() < m_options.branches && i >= forkAt && branches[0].hasHead ) {
+      Branch fork = branches[0];
+      fork.name = QString::fromLatin1( "feature-%1" ).arg( branches.count() );
+      branches << fork;
+    }
+
+    const int index = random.next( branches.count() );
+    Branch &branch = branches[index];
+    for ( int j = 0; j < m_options.filesPerCommit && m_errorString.isEmpty(); ++j ) {
+      const int file = random.next( m_options.files );
+      QByteArray lines;
+      for ( int line = 0; line < m_options.diffLines; ++line )
+        lines += "Change " + QByteArray::number( i ) + ", line " + QByteArray::number( line ) + '\n';
+      insertLines( &branch.files[file], random.next( InitialLines ), lines );
+      if ( git_blob_create_frombuffer( &branch.blobs[file], repository, branch.files[file].constData(),
+                                       branch.files[file].size() ) != GIT_OK )
+        m_errorString = lastGitError( "git_blob_create_frombuffer" );
+    }
+
+    git_treebuilder *builder = 0;
+    git_oid treeOid;
+    git_tree *tree = 0;
+    if ( m_errorString.isEmpty() && git_treebuilder_create( &builder, 0 ) != GIT_OK )
+      m_errorString = lastGitError( "git_treebuilder_create" );
+    for ( int file = 0; file < m_options.files && m_errorString.isEmpty(); ++file ) {
+      if ( git_treebuilder_insert( 0, builder, fileName( file ).constData(), &branch.blobs[file],
+                                   GIT_FILEMODE_BLOB ) != GIT_OK )
+        m_errorString = lastGitError( "git_treebuilder_insert" );
+    }
+    if ( m_errorString.isEmpty() && ( git_treebuilder_write( &treeOid, repository, builder ) != GIT_OK ||
+                                      git_tree_lookup( &tree, repository, &treeOid ) != GIT_OK ) )
+      m_errorString = lastGitError( "git_treebuilder_write" );
+    git_treebuilder_free( builder );
+
+    // Master takes a branch in now and then, keeping its own tree
+    const git_oid *parentOids[2];
+    int parentCount = 0;
+    if ( branch.hasHead )
+      parentOids[parentCount++] = &branch.head;
+    if ( index == 0 && branches.count() > 1 && random.next( 10 ) == 0 )
+      parentOids[parentCount++] = &branches[1 + random.next( branches.count() - 1 )].head;
+
+    git_commit *parents[2] = { 0, 0 };
+    for ( int p = 0; p < parentCount && m_errorString.isEmpty(); ++p ) {
+      if ( git_commit_lookup( &parents[p], repository, parentOids[p] ) != GIT_OK )
+        m_errorString = lastGitError( "git_commit_lookup" );
+    }
+
+    const int author = random.next( Authors );
+    const QByteArray name = "Developer " + QByteArray::number( author );
+    const QByteArray email = "developer" + QByteArray::number( author ) + "@example.org";
+    const QByteArray message = "Change " + QByteArray::number( i ) + " on " + branch.name.toLatin1() +
+                               "\n\nTouches " + QByteArray::number( m_options.filesPerCommit ) + " files.\n";
+    git_signature *signature = 0;
+    if ( m_errorString.isEmpty() &&
+         git_signature_new( &signature, name.constData(), email.constData(), time, 0 ) != GIT_OK )
+      m_errorString = lastGitError( "git_signature_new" );
+
+    git_oid commit;
+    if ( m_errorString.isEmpty() &&
+         git_commit_create( &commit, repository, 0, signature, signature, 0, message.constData(),
+                            tree, parentCount, const_cast<const git_commit**>( parents ) ) != GIT_OK )
+      m_errorString = lastGitError( "git_commit_create" );
+
+    if ( m_errorString.isEmpty() ) {
+      branch.head = commit;
+      branch.hasHead = true;
+    }
+
+    git_signature_free( signature );
+    for ( int p = 0; p < parentCount; ++p )
+      git_commit_free( parents[p] );
+    git_tree_free( tree );
+  }
+
+  for ( int i = 0; i < branches.count() && m_errorString.isEmpty(); ++i ) {
+    if ( !branches[i].hasHead )
+      continue;
+    const QByteArray refName = "refs/remotes/origin/" + branches[i].name.toLatin1();
+    git_reference *reference = 0;
+    if ( git_reference_create( &reference, repository, refName.constData(), &branches[i].head, 1 ) != GIT_OK ) {
+      m_errorString = lastGitError( "git_reference_create" );
+    } else {
+      git_reference_free( reference );
+      m_branches << branches[i].name;
+    }
+  }
+
+  git_repository_free( repository );
+  return m_errorString.isEmpty();
+}
+
+QStringList RepoGenerator::branches() const
+{
+  return m_branches;
+}
+
+QString RepoGenerator::errorString() const
+{
+  return m_errorString;
+}
@@ -0,0 +1,70 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#ifndef REPO_GENERATOR_H_
+#define REPO_GENERATOR_H_
+
+#include <QString>
+#include <QStringList>
+
+/**
+ * Writes a git repository of made up history, the same one for the same options.
+ *
+ * Commits go on "master" and on branches forked from it, each touching a few files,
+ * and master merges a branch now and then. Every branch is also written as
+ * refs/remotes/origin/<branch>, which is where the resource looks.
+ */
+class RepoGenerator {
+public:
+  struct Options {
+    Options();
+
+    /**
+     * Defaults overridden by the BENCHMARK_COMMITS, BENCHMARK_BRANCHES,
+     * BENCHMARK_FILES, BENCHMARK_FILES_PER_COMMIT and BENCHMARK_DIFF_LINES
+     * environment variables.
+     */
+    static Options fromEnvironment();
+
+    int commits;
+    int branches;        // including master
+    int files;           // in the tree
+    int filesPerCommit;
+    int diffLines;       // lines added to each touched file
+    unsigned int seed;
+  };
+
+  explicit RepoGenerator( const Options &options );
+
+  /**
+   * Creates the repository at @p path, which must not be one yet.
+   */
+  bool generate( const QString &path );
+
+  QStringList branches() const;
+  QString errorString() const;
+
+private:
+  Options m_options;
+  QStringList m_branches;
+  QString m_errorString;
+};
+
+#endif
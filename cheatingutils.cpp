@@ -21,31 +21,89 @@
 
 #include <KLocale>
 #include <KDebug>
+#include <KGlobal>
+#include <kde_file.h>
 
+#include <QDir>
 #include <QFile>
-#include <QProcess>
+#include <QDirIterator>
 #include <QByteArray>
+#include <QMutex>
+#include <QMutexLocker>
 
-QByteArray CheatingUtils::getRemoteHead( const QString repoPath )
+#include <string.h>
+
+static const char RemotePrefix[] = "refs/remotes/origin/";
+
+namespace {
+  // git rewrites packed-refs through a lock file and a rename, so the
+  // inode changes even when the size and the second of the mtime don't
+  struct PackedRefs {
+    PackedRefs() : inode( 0 ), modified( 0 ), size( -1 ) {}
+    quint64 inode;
+    qint64 modified;
+    qint64 size;
+    QHash<QString,QByteArray> heads;
+  };
+
+  struct PackedRefsCache {
+    QMutex mutex; // We're called from the resource and from the worker thread
+    QHash<QString,PackedRefs> entries; // keyed by packed-refs path
+  };
+}
+
+K_GLOBAL_STATIC( PackedRefsCache, s_packedRefsCache )
+
+static void parsePackedRefs( const char *data, qint64 size, QHash<QString,QByteArray> *heads )
+{
+  const int prefixLength = sizeof( RemotePrefix ) - 1;
+  const char *line = data;
+  const char *const end = data + size;
+  while ( line < end ) {
+    const char *eol = static_cast<const char*>( memchr( line, '\n', end - line ) );
+    if ( !eol )
+      eol = end;
+
+    // "<sha1> <refname>", skipping the header and the peeled "^<sha1>" lines
+    const char *name = line + 41;
+    if ( name + prefixLength < eol && line[40] == ' ' &&
+         strncmp( name, RemotePrefix, prefixLength ) == 0 ) {
+      const char *nameEnd = eol;
+      if ( nameEnd[-1] == '\r' )
+        --nameEnd;
+      const QString branch = QString::fromUtf8( name + prefixLength, nameEnd - name - prefixLength );
+      if ( !branch.isEmpty() && branch != QLatin1String( "HEAD" ) )
+        heads->insert( branch, QByteArray( line, 40 ) );
+    }
+    line = eol + 1;
+  }
+}
+
+QByteArray CheatingUtils::getRemoteHead( const QString repoPath, const QString &branch )
 {
   QByteArray sha1;
-  QFile file( repoPath + QLatin1String( "/refs/remotes/origin/master" ) );
+  QString refName = QLatin1String( RemotePrefix ) + branch;
+  QFile file( repoPath + QLatin1Char( '/' ) + refName );
 
-  // TODO: remove all this logic when we have branch support.
-  if ( !file.exists() ) {
+  // Old clones might not have origin/master, only origin/HEAD
+  if ( !file.exists() && branch == QLatin1String( "master" ) &&
+       !packedRemoteHeads( repoPath ).contains( branch ) ) {
     kDebug() << "Master doesn't exist, falling back to HEAD";
     QFile headFile( repoPath + QLatin1String( "/refs/remotes/origin/HEAD" ) );
     if ( headFile.open( QIODevice::ReadOnly | QIODevice::Text ) ) {
       const QList<QByteArray> tokens = headFile.readLine().trimmed().split( ' ' );
       if ( tokens.count() == 2 ) {
-        const QString head = tokens.at( 1 );
-        file.setFileName( repoPath + QLatin1Char('/') + head );
+        refName = QString::fromUtf8( tokens.at( 1 ) );
+        file.setFileName( repoPath + QLatin1Char('/') + refName );
       }
     }
   }
 
   if ( file.open( QIODevice::ReadOnly | QIODevice::Text ) ) {
     sha1 = file.readLine().trimmed();
+  } else if ( refName.startsWith( QLatin1String( RemotePrefix ) ) ) {
+    // Not a loose ref, git pack-refs might have moved it
+    sha1 = packedRemoteHeads( repoPath ).value( refName.mid( sizeof( RemotePrefix ) - 1 ) );
   }
 
   if ( sha1.isEmpty() )
@@ -53,34 +111,51 @@ QByteArray CheatingUtils::getRemoteHead( const QString repoPath )
   return sha1;
 }
 
-bool CheatingUtils::gitFetch( const QString &path, QString *out_errorMessage )
+QStringList CheatingUtils::remoteBranches( const QString &repoPath )
 {
-  QProcess *process = new QProcess();
-  process->setWorkingDirectory( path );
-  process->start( QLatin1String( "git fetch origin" ) );
-  process->waitForFinished();
-  bool result = true;
-  if ( process->exitCode() != 0 ) {
-    result = false;
-    *out_errorMessage = i18n( "Error doing git fetch: %1", QString::number( process->exitCode() ) );
+  QStringList branches = packedRemoteHeads( repoPath ).keys();
+  const QDir refsDir( repoPath + QLatin1String( "/refs/remotes/origin/" ) );
+  QDirIterator it( refsDir.path(), QDir::Files, QDirIterator::Subdirectories );
+  while ( it.hasNext() ) {
+    const QString branch = refsDir.relativeFilePath( it.next() );
+    if ( branch != QLatin1String( "HEAD" ) && !branch.endsWith( QLatin1String( ".lock" ) ) &&
+         !branches.contains( branch ) )
+      branches << branch;
   }
-  process->deleteLater();
-  return result;
+
+  branches.sort();
+  return branches;
 }
 
-bool CheatingUtils::gitDiff( const QString &path, const QString &sha1,
-                             QByteArray *out_diff, QString *out_errorMessage )
+QHash<QString,QByteArray> CheatingUtils::packedRemoteHeads( const QString &repoPath )
 {
-  QProcess *process = new QProcess();
-  process->setWorkingDirectory( path );
-  process->start( QLatin1String( "git show " ) + sha1 );
-  process->waitForFinished();
-  *out_diff = process->readAllStandardOutput();
-  bool result = true;
-  if ( process->exitCode() != 0 ) {
-    result = true;
-    *out_errorMessage = i18n( "Error obtaining diff: %1", QString::number( process->exitCode() ) );
+  const QString path = repoPath + QLatin1String( "/packed-refs" );
+  KDE_struct_stat buf;
+  if ( KDE::stat( path, &buf ) != 0 )
+    return QHash<QString,QByteArray>();
+
+  QMutexLocker locker( &s_packedRefsCache->mutex );
+  PackedRefs &entry = s_packedRefsCache->entries[path];
+  if ( entry.inode == quint64( buf.st_ino ) && entry.modified == qint64( buf.st_mtime ) &&
+       entry.size == qint64( buf.st_size ) )
+    return entry.heads;
+
+  entry.heads.clear();
+  QFile file( path );
+  if ( file.open( QIODevice::ReadOnly ) ) {
+    const qint64 size = file.size();
+    // Big repositories have packed-refs of several MB, most of it tags
+    if ( const uchar *data = size > 0 ? file.map( 0, size ) : 0 ) {
+      parsePackedRefs( reinterpret_cast<const char*>( data ), size, &entry.heads );
+      file.unmap( const_cast<uchar*>( data ) );
+    } else {
+      const QByteArray contents = file.readAll();
+      parsePackedRefs( contents.constData(), contents.size(), &entry.heads );
+    }
   }
-  process->deleteLater();
-  return result;
-}
\ No newline at end of file
+
+  entry.inode = buf.st_ino;
+  entry.modified = buf.st_mtime;
+  entry.size = buf.st_size;
+  return entry.heads;
+}
@@ -24,18 +24,23 @@
 
 #include <KLocale>
 
+#include <QHash>
 #include <QString>
+#include <QStringList>
 #include <QByteArray>
 
 namespace CheatingUtils {
 
-  // returns the SHA1 for origin/master
-  QByteArray getRemoteHead( const QString repoPath );
+  // returns the SHA1 for origin/<branch>
+  QByteArray getRemoteHead( const QString repoPath,
+                            const QString &branch = QLatin1String( "master" ) );
 
-  bool gitFetch( const QString &path, QString *out_errorMessage );
+  // returns the branches of origin, without HEAD
+  QStringList remoteBranches( const QString &repoPath );
 
-  bool gitDiff( const QString &path, const QString &sha1,
-                QByteArray *out_diff, QString *out_errorMessage );
+  // returns the origin branches found in packed-refs, branch -> SHA1.
+  // The file is parsed once and cached until it's rewritten.
+  QHash<QString,QByteArray> packedRemoteHeads( const QString &repoPath );
 }
 
 #endif
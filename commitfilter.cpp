@@ -0,0 +1,143 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "commitfilter.h"
+#include "settings.h"
+
+#include <KDebug>
+
+#include <QString>
+#include <QStringList>
+
+#include <git2/signature.h>
+
+#include <ctype.h>
+#include <string.h>
+
+static QList<QByteArray> toLowerUtf8( const QStringList &list )
+{
+  QList<QByteArray> result;
+  foreach( const QString &str, list ) {
+    const QString trimmed = str.trimmed();
+    if ( !trimmed.isEmpty() )
+      result << trimmed.toLower().toUtf8();
+  }
+  return result;
+}
+
+CommitFilter::CommitFilter( GitSettings *settings )
+{
+  m_includeAuthors = toLowerUtf8( settings->includeAuthors() );
+  m_excludeAuthors = toLowerUtf8( settings->excludeAuthors() );
+
+  if ( !settings->scripty() )
+    m_botPatterns = toLowerUtf8( settings->botPatterns() );
+
+  foreach( const QString &pattern, settings->subjectExcludePatterns() ) {
+    if ( pattern.isEmpty() )
+      continue;
+    const QRegExp regExp( pattern, Qt::CaseInsensitive );
+    if ( regExp.isValid() ) {
+      m_subjectPatterns << regExp;
+    } else {
+      kWarning() << "Ignoring invalid subject pattern" << pattern << regExp.errorString();
+    }
+  }
+}
+
+bool CommitFilter::accepts( const git_commit *commit ) const
+{
+  const git_signature *author = git_commit_author( commit );
+  if ( !acceptsAuthor( author ? author->email : "" ) )
+    return false;
+
+  if ( !m_subjectPatterns.isEmpty() ) {
+    const char *message = git_commit_message( commit );
+    const char *newLine = strchr( message, '\n' );
+    return acceptsSubject( message, newLine ? int( newLine - message ) : int( strlen( message ) ) );
+  }
+
+  return true;
+}
+
+bool CommitFilter::accepts( const char *email, const char *subject, int subjectLength ) const
+{
+  return acceptsAuthor( email ) && ( m_subjectPatterns.isEmpty() || acceptsSubject( subject, subjectLength ) );
+}
+
+bool CommitFilter::acceptsAuthor( const char *email ) const
+{
+  if ( !m_includeAuthors.isEmpty() && !matchesAny( m_includeAuthors, email ) )
+    return false;
+
+  if ( matchesAny( m_excludeAuthors, email ) )
+    return false;
+
+  foreach( const QByteArray &pattern, m_botPatterns ) {
+    if ( wildcardMatch( pattern.constData(), email ) )
+      return false;
+  }
+
+  return true;
+}
+
+bool CommitFilter::acceptsSubject( const char *subject, int length ) const
+{
+  const QString decoded = QString::fromUtf8( subject, length );
+  foreach( const QRegExp &regExp, m_subjectPatterns ) {
+    if ( regExp.indexIn( decoded ) != -1 )
+      return false;
+  }
+  return true;
+}
+
+bool CommitFilter::matchesAny( const QList<QByteArray> &authors, const char *email )
+{
+  foreach( const QByteArray &author, authors ) {
+    if ( qstricmp( author.constData(), email ) == 0 )
+      return true;
+  }
+  return false;
+}
+
+bool CommitFilter::wildcardMatch( const char *pattern, const char *str )
+{
+  // Case insensitive, supports '*' and '?'. The pattern is already lower case.
+  const char *star = 0;
+  const char *backtrack = 0;
+  while ( *str ) {
+    if ( *pattern == '*' ) {
+      star = pattern++;
+      backtrack = str;
+    } else if ( *pattern == '?' || *pattern == tolower( static_cast<unsigned char>( *str ) ) ) {
+      ++pattern;
+      ++str;
+    } else if ( star ) {
+      pattern = star + 1;
+      str = ++backtrack;
+    } else {
+      return false;
+    }
+  }
+
+  while ( *pattern == '*' )
+    ++pattern;
+
+  return *pattern == '\0';
+}
@@ -0,0 +1,61 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef COMMIT_FILTER_H_
+#define COMMIT_FILTER_H_
+
+#include <QList>
+#include <QRegExp>
+#include <QByteArray>
+
+#include <git2/commit.h>
+
+class GitSettings;
+
+/**
+ * The user's author and subject filters, compiled once per sync.
+ *
+ * accepts() works directly on libgit2's buffers, so rejected commits never
+ * get a QString or QByteArray allocated for them. The subject is only decoded
+ * if there are subject patterns and the author filters passed.
+ */
+class CommitFilter {
+public:
+  explicit CommitFilter( GitSettings *settings );
+
+  bool accepts( const git_commit *commit ) const;
+
+  /**
+   * Same, for commits that come from the CommitIndex. @p email must be null terminated.
+   */
+  bool accepts( const char *email, const char *subject, int subjectLength ) const;
+
+private:
+  bool acceptsAuthor( const char *email ) const;
+  bool acceptsSubject( const char *subject, int length ) const;
+  static bool matchesAny( const QList<QByteArray> &authors, const char *email );
+  static bool wildcardMatch( const char *pattern, const char *str );
+
+  QList<QByteArray> m_includeAuthors;
+  QList<QByteArray> m_excludeAuthors;
+  QList<QByteArray> m_botPatterns;
+  QList<QRegExp> m_subjectPatterns;
+};
+
+#endif
@@ -0,0 +1,323 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "commitindex.h"
+
+#include <KDebug>
+
+#include <QDir>
+
+#include <git2/commit.h>
+#include <git2/signature.h>
+
+#include <string.h>
+
+// Bump when Record changes, old indexes are then thrown away
+static const char Magic[8] = { 'G', 'I', 'T', 'I', 'D', 'X', '0', '1' };
+
+enum {
+  HeaderSize = 16 // magic and padding, so records stay 8 byte aligned
+};
+
+// The on-disk layout must not depend on the compiler
+typedef char RecordSizeCheck[sizeof( CommitIndex::Record ) == 56 ? 1 : -1];
+
+CommitIndex::CommitIndex( const QString &directory ) : m_directory( directory )
+                                                     , m_opened( false )
+                                                     , m_commits( 0 )
+                                                     , m_subjects( 0 )
+                                                     , m_subjectsSize( 0 )
+                                                     , m_count( 0 )
+{
+  m_commitsFile.setFileName( directory + QLatin1String( "/commits" ) );
+  m_subjectsFile.setFileName( directory + QLatin1String( "/subjects" ) );
+  m_authorsFile.setFileName( directory + QLatin1String( "/authors" ) );
+}
+
+CommitIndex::~CommitIndex()
+{
+  unmap();
+}
+
+bool CommitIndex::open()
+{
+  if ( m_opened )
+    return true;
+
+  QDir().mkpath( m_directory );
+  if ( !m_commitsFile.open( QIODevice::ReadWrite ) || !m_subjectsFile.open( QIODevice::ReadWrite ) ||
+       !m_authorsFile.open( QIODevice::ReadWrite ) ) {
+    kWarning() << "Can't open the commit index in" << m_directory;
+    m_commitsFile.close();
+    m_subjectsFile.close();
+    m_authorsFile.close();
+    return false;
+  }
+  m_opened = true;
+
+  char magic[sizeof( Magic )];
+  if ( m_commitsFile.read( magic, sizeof( magic ) ) != sizeof( magic ) ||
+       memcmp( magic, Magic, sizeof( Magic ) ) != 0 ) {
+    clear();
+    return true;
+  }
+
+  qint64 authorsSize = 0;
+  while ( !m_authorsFile.atEnd() ) {
+    const QByteArray email = m_authorsFile.readLine();
+    if ( !email.endsWith( '\n' ) ) // Torn write
+      break;
+    authorsSize += email.length();
+    m_authorIds.insert( email.left( email.length() - 1 ), m_authors.count() );
+    m_authors << email.left( email.length() - 1 );
+  }
+  // Or the next author would be appended to what's left of it
+  if ( authorsSize != m_authorsFile.size() ) {
+    kWarning() << "Dropping a torn line from the commit index's authors";
+    m_authorsFile.resize( authorsSize );
+  }
+
+  if ( !map() ) {
+    clear();
+    return true;
+  }
+
+  // Records are written last, so anything they point to is there, unless a
+  // write was interrupted. Drop the records that point past the end.
+  int valid = 0;
+  for ( ; valid < m_count; ++valid ) {
+    const Record &r = record( valid );
+    if ( r.author >= quint32( m_authors.count() ) ||
+         qint64( r.subjectOffset ) + r.subjectLength > m_subjectsSize )
+      break;
+  }
+  if ( valid != m_count ) {
+    kWarning() << "Truncating the commit index to" << valid << "records";
+    unmap();
+    m_commitsFile.resize( HeaderSize + qint64( valid ) * sizeof( Record ) );
+    map();
+  }
+
+  for ( int i = 0; i < m_count; ++i )
+    m_records.insert( record( i ).oid, i );
+
+  kDebug() << "Commit index has" << m_count << "commits";
+  return true;
+}
+
+bool CommitIndex::map()
+{
+  unmap();
+
+  const qint64 recordsSize = m_commitsFile.size() - HeaderSize;
+  m_count = recordsSize > 0 ? int( recordsSize / sizeof( Record ) ) : 0;
+  if ( m_count > 0 ) {
+    m_commits = m_commitsFile.map( HeaderSize, qint64( m_count ) * sizeof( Record ) );
+    if ( !m_commits ) {
+      m_count = 0;
+      return false;
+    }
+  }
+
+  m_subjectsSize = m_subjectsFile.size();
+  if ( m_subjectsSize > 0 ) {
+    m_subjects = m_subjectsFile.map( 0, m_subjectsSize );
+    if ( !m_subjects ) {
+      unmap();
+      return false;
+    }
+  }
+  return true;
+}
+
+void CommitIndex::unmap()
+{
+  if ( m_commits )
+    m_commitsFile.unmap( const_cast<uchar*>( m_commits ) );
+  if ( m_subjects )
+    m_subjectsFile.unmap( const_cast<uchar*>( m_subjects ) );
+  m_commits = 0;
+  m_subjects = 0;
+  m_subjectsSize = 0;
+  m_count = 0;
+}
+
+void CommitIndex::clear()
+{
+  if ( !m_opened && !open() )
+    return;
+
+  unmap();
+  m_records.clear();
+  m_authors.clear();
+  m_authorIds.clear();
+  m_pending.clear();
+  m_pendingIndex.clear();
+
+  m_subjectsFile.resize( 0 );
+  m_authorsFile.resize( 0 );
+  m_commitsFile.resize( 0 );
+  m_commitsFile.seek( 0 );
+  char header[HeaderSize];
+  memset( header, 0, sizeof( header ) );
+  memcpy( header, Magic, sizeof( Magic ) );
+  m_commitsFile.write( header, sizeof( header ) );
+  m_commitsFile.flush();
+}
+
+int CommitIndex::count() const
+{
+  return m_count;
+}
+
+int CommitIndex::find( const git_oid &oid )
+{
+  if ( !open() )
+    return -1;
+  return m_records.value( oid, -1 );
+}
+
+const CommitIndex::Record &CommitIndex::record( int index ) const
+{
+  Q_ASSERT( index >= 0 && index < m_count );
+  return reinterpret_cast<const Record*>( m_commits )[index];
+}
+
+bool CommitIndex::hasAllParents( int index ) const
+{
+  const Record &r = record( index );
+  if ( r.parentCount > 2 )
+    return false;
+  for ( quint32 i = 0; i < r.parentCount; ++i ) {
+    if ( r.parents[i] == 0 )
+      return false;
+  }
+  return true;
+}
+
+int CommitIndex::parent( int index, int i ) const
+{
+  Q_ASSERT( i >= 0 && i < 2 );
+  return int( record( index ).parents[i] ) - 1;
+}
+
+QByteArray CommitIndex::author( int index ) const
+{
+  return m_authors.at( record( index ).author );
+}
+
+QByteArray CommitIndex::subject( int index ) const
+{
+  const Record &r = record( index );
+  return QByteArray( reinterpret_cast<const char*>( m_subjects ) + r.subjectOffset, r.subjectLength );
+}
+
+void CommitIndex::add( git_commit *commit )
+{
+  const git_oid *oid = git_commit_id( commit );
+  if ( !open() || m_records.contains( *oid ) || m_pendingIndex.contains( *oid ) )
+    return;
+
+  Pending pending;
+  pending.oid = *oid;
+  pending.parentCount = git_commit_parentcount( commit );
+  for ( quint32 i = 0; i < 2; ++i ) {
+    if ( i < pending.parentCount )
+      git_oid_cpy( &pending.parents[i], git_commit_parent_id( commit, i ) );
+    else
+      memset( &pending.parents[i], 0, sizeof( git_oid ) );
+  }
+  pending.time = git_commit_time( commit );
+
+  const git_signature *author = git_commit_author( commit );
+  pending.author = author ? QByteArray( author->email ) : QByteArray();
+
+  const char *message = git_commit_message( commit );
+  const char *newLine = strchr( message, '\n' );
+  pending.subject = QByteArray( message, newLine ? int( newLine - message ) : int( strlen( message ) ) );
+
+  m_pendingIndex.insert( *oid, m_pending.count() );
+  m_pending << pending;
+}
+
+quint32 CommitIndex::internAuthor( const QByteArray &email )
+{
+  QHash<QByteArray,quint32>::const_iterator it = m_authorIds.constFind( email );
+  if ( it != m_authorIds.constEnd() )
+    return it.value();
+
+  const quint32 id = m_authors.count();
+  m_authorsFile.seek( m_authorsFile.size() );
+  m_authorsFile.write( email + '\n' );
+  m_authors << email;
+  m_authorIds.insert( email, id );
+  return id;
+}
+
+bool CommitIndex::flush()
+{
+  if ( m_pending.isEmpty() )
+    return true;
+
+  unmap();
+
+  // Parents are always walked after their children, so going backwards writes them first
+  QByteArray subjects;
+  QByteArray records;
+  records.reserve( m_pending.count() * sizeof( Record ) );
+  const qint64 subjectsBase = m_subjectsFile.size();
+  const int firstRecord = int( ( m_commitsFile.size() - HeaderSize ) / sizeof( Record ) );
+  int written = 0;
+  for ( int i = m_pending.count() - 1; i >= 0; --i ) {
+    const Pending &pending = m_pending.at( i );
+    Record r;
+    memset( &r, 0, sizeof( r ) );
+    r.oid = pending.oid;
+    r.parentCount = pending.parentCount;
+    for ( quint32 p = 0; p < qMin( pending.parentCount, quint32( 2 ) ); ++p ) {
+      const int parent = m_records.value( pending.parents[p], -1 );
+      r.parents[p] = parent == -1 ? 0 : quint32( parent + 1 );
+    }
+    r.time = pending.time;
+    r.author = internAuthor( pending.author );
+    r.subjectOffset = quint32( subjectsBase + subjects.size() );
+    r.subjectLength = pending.subject.size();
+    subjects += pending.subject;
+
+    records.append( reinterpret_cast<const char*>( &r ), sizeof( r ) );
+    m_records.insert( pending.oid, firstRecord + written++ );
+  }
+
+  m_pending.clear();
+  m_pendingIndex.clear();
+
+  // Authors and subjects first, records point to them
+  m_authorsFile.flush();
+  m_subjectsFile.seek( subjectsBase );
+  bool ok = m_subjectsFile.write( subjects ) == subjects.size() && m_subjectsFile.flush();
+  m_commitsFile.seek( HeaderSize + qint64( firstRecord ) * sizeof( Record ) );
+  ok = ok && m_commitsFile.write( records ) == records.size() && m_commitsFile.flush();
+
+  if ( !ok || !map() ) {
+    kWarning() << "Error writing the commit index, starting over";
+    clear();
+    return false;
+  }
+  return true;
+}
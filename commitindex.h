@@ -0,0 +1,132 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef COMMIT_INDEX_H_
+#define COMMIT_INDEX_H_
+
+#include "gitoid.h"
+
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+
+#include <git2/types.h>
+
+/**
+ * Persistent metadata of the commits walked so far, so listing doesn't need libgit2.
+ *
+ * Three append-only files in the resource's data dir:
+ * - commits: a header and one fixed-width Record per commit, memory-mapped
+ * - authors: interned author e-mails, one per line, referenced by number
+ * - subjects: the subjects, back to back, referenced by offset and length
+ *
+ * Commits never change, so the index never goes stale. It only has to be
+ * thrown away when the repository changes. New commits are collected with
+ * add() during a walk and written by flush(), parents first, so a record can
+ * point to its parents' records. Parents that weren't walked, because they're
+ * older than the cutoff for example, are left unresolved and hasAllParents()
+ * returns false.
+ *
+ * Not thread safe, it's only used from GitThread.
+ */
+class CommitIndex {
+public:
+  struct Record {
+    git_oid oid;
+    quint32 parents[2];      // record number + 1 of the first two parents, 0 if not indexed
+    quint32 parentCount;
+    qint64 time;             // commit time
+    quint32 author;          // line in the authors file
+    quint32 subjectOffset;
+    quint32 subjectLength;
+    quint32 reserved;
+  };
+
+  explicit CommitIndex( const QString &directory );
+  ~CommitIndex();
+
+  /**
+   * Maps the index. Called on first use, there's no need to call it explicitly.
+   */
+  bool open();
+
+  /**
+   * Removes everything, for when the repository changes.
+   */
+  void clear();
+
+  int count() const;
+
+  /**
+   * Returns the record number of @p oid, or -1 if it isn't indexed.
+   */
+  int find( const git_oid &oid );
+
+  const Record &record( int index ) const;
+  bool hasAllParents( int index ) const;
+  int parent( int index, int i ) const;
+  QByteArray author( int index ) const;
+  QByteArray subject( int index ) const;
+
+  /**
+   * Queues @p commit for the next flush(), unless it's indexed or queued already.
+   */
+  void add( git_commit *commit );
+
+  /**
+   * Writes what was added since the last flush.
+   */
+  bool flush();
+
+private:
+  struct Pending {
+    git_oid oid;
+    git_oid parents[2];
+    quint32 parentCount;
+    qint64 time;
+    QByteArray author;
+    QByteArray subject;
+  };
+
+  bool map();
+  void unmap();
+  quint32 internAuthor( const QByteArray &email );
+
+  const QString m_directory;
+  bool m_opened;
+
+  QFile m_commitsFile;
+  QFile m_subjectsFile;
+  QFile m_authorsFile;
+  const uchar *m_commits;
+  const uchar *m_subjects;
+  qint64 m_subjectsSize;
+  int m_count;
+
+  QHash<git_oid,int> m_records;
+  QVector<QByteArray> m_authors;
+  QHash<QByteArray,quint32> m_authorIds;
+
+  QVector<Pending> m_pending;
+  QHash<git_oid,int> m_pendingIndex;
+};
+
+#endif
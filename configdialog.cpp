@@ -24,6 +24,17 @@
 #include <Akonadi/CollectionRequester>
 
 #include <QDateTime>
+#include <QStringList>
+
+static QStringList splitList( const QString &text )
+{
+  QStringList result;
+  foreach( const QString &str, text.split( QLatin1Char( ',' ), QString::SkipEmptyParts ) ) {
+    if ( !str.trimmed().isEmpty() )
+      result << str.trimmed();
+  }
+  return result;
+}
 
 ConfigDialog::ConfigDialog( GitSettings *settings, QWidget *parent) :
     KDialog( parent ), mSettings( settings )
@@ -33,6 +44,10 @@ ConfigDialog::ConfigDialog( GitSettings *settings, QWidget *parent) :
   ui.repository->setUrl( KUrl( mSettings->repository() ) );
   ui.from->setDateTime( mSettings->from() );
   ui.scripty->setChecked( mSettings->scripty() );
+  ui.botPatterns->setText( mSettings->botPatterns().join( QLatin1String( ", " ) ) );
+  ui.includeAuthors->setText( mSettings->includeAuthors().join( QLatin1String( ", " ) ) );
+  ui.excludeAuthors->setText( mSettings->excludeAuthors().join( QLatin1String( ", " ) ) );
+  ui.subjectPatterns->setText( mSettings->subjectExcludePatterns().join( QLatin1String( ", " ) ) );
   ui.repository->setMode( KFile::Directory );
 
   connect( this, SIGNAL(okClicked()), this, SLOT(save()) );
@@ -43,6 +58,10 @@ void ConfigDialog::save()
 {
   mSettings->setFrom( ui.from->dateTime() );
   mSettings->setScripty( ui.scripty->checkState() == Qt::Checked );
+  mSettings->setBotPatterns( splitList( ui.botPatterns->text() ) );
+  mSettings->setIncludeAuthors( splitList( ui.includeAuthors->text() ) );
+  mSettings->setExcludeAuthors( splitList( ui.excludeAuthors->text() ) );
+  mSettings->setSubjectExcludePatterns( splitList( ui.subjectPatterns->text() ) );
   mSettings->setRepository( ui.repository->url().path() );
   mSettings->writeConfig();
 }
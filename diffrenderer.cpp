@@ -0,0 +1,292 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "diffrenderer.h"
+
+#include <KDebug>
+
+#include <QLocale>
+#include <QDateTime>
+#include <QIODevice>
+
+#include <git2/oid.h>
+#include <git2/diff.h>
+#include <git2/tree.h>
+#include <git2/commit.h>
+#include <git2/errors.h>
+#include <git2/signature.h>
+
+static QString lastGitError( const char *what )
+{
+  const git_error *error = giterr_last();
+  return QString::fromLatin1( what ) + QLatin1String( ": " ) +
+         ( error ? QString::fromUtf8( error->message ) : QLatin1String( "unknown error" ) );
+}
+
+static QByteArray formatDate( const git_time &when )
+{
+  // Same as git's default date format, in the author's timezone
+  const QDateTime dateTime = QDateTime::fromMSecsSinceEpoch( ( when.time + when.offset * 60 ) * 1000 ).toUTC();
+  const int offset = qAbs( when.offset );
+  return QLocale::c().toString( dateTime, QLatin1String( "ddd MMM d hh:mm:ss yyyy" ) ).toLatin1() +
+         QString().sprintf( " %c%02d%02d", when.offset < 0 ? '-' : '+', offset / 60, offset % 60 ).toLatin1();
+}
+
+namespace {
+  struct PrintState {
+    QIODevice *device;
+    qint64 limit;         // for the current file, 0 for none
+    qint64 written;       // for the current file
+    int skippedLines;     // for the current file, once over the limit
+    bool error;
+  };
+}
+
+static int printCallback( const git_diff_delta *delta, const git_diff_range *range,
+                          char lineOrigin, const char *content, size_t contentLength, void *payload )
+{
+  Q_UNUSED( delta );
+  Q_UNUSED( range );
+  PrintState *state = static_cast<PrintState*>( payload );
+
+  // Only context, addition and deletion lines come without their prefix
+  const bool isLine = lineOrigin == GIT_DIFF_LINE_CONTEXT || lineOrigin == GIT_DIFF_LINE_ADDITION ||
+                      lineOrigin == GIT_DIFF_LINE_DELETION;
+
+  // Over the limit lines are only counted, libgit2 has them in memory already anyway
+  if ( state->limit > 0 && state->written >= state->limit ) {
+    if ( isLine )
+      ++state->skippedLines;
+    return 0;
+  }
+
+  if ( isLine && !state->device->putChar( lineOrigin ) ) {
+    state->error = true;
+    return -1;
+  }
+
+  if ( state->device->write( content, contentLength ) != qint64( contentLength ) ) {
+    state->error = true;
+    return -1;
+  }
+  state->written += contentLength + ( isLine ? 1 : 0 );
+  return 0;
+}
+
+static const char *deltaPath( const git_diff_delta *delta )
+{
+  return delta->new_file.path ? delta->new_file.path : delta->old_file.path;
+}
+
+DiffRenderer::DiffRenderer( git_repository *repository ) : m_repository( repository )
+                                                         , m_totalLimit( 0 )
+                                                         , m_fileLimit( 0 )
+                                                         , m_truncated( false )
+{
+  Q_ASSERT( repository );
+}
+
+void DiffRenderer::setLimits( qint64 totalBytes, qint64 fileBytes )
+{
+  m_totalLimit = totalBytes;
+  m_fileLimit = fileBytes;
+}
+
+void DiffRenderer::setGeneratedFilePatterns( const QStringList &patterns )
+{
+  m_generatedPatterns.clear();
+  foreach( const QString &pattern, patterns ) {
+    if ( !pattern.trimmed().isEmpty() )
+      m_generatedPatterns << QRegExp( pattern.trimmed(), Qt::CaseSensitive, QRegExp::Wildcard );
+  }
+}
+
+bool DiffRenderer::isGenerated( const char *path ) const
+{
+  if ( m_generatedPatterns.isEmpty() )
+    return false;
+
+  const QString filePath = QString::fromUtf8( path );
+  const QString fileName = filePath.mid( filePath.lastIndexOf( QLatin1Char( '/' ) ) + 1 );
+  foreach( const QRegExp &pattern, m_generatedPatterns ) {
+    if ( pattern.exactMatch( filePath ) || pattern.exactMatch( fileName ) )
+      return true;
+  }
+  return false;
+}
+
+bool DiffRenderer::isTruncated() const
+{
+  return m_truncated;
+}
+
+bool DiffRenderer::render( git_commit *commit, QIODevice *device )
+{
+  Q_ASSERT( commit );
+  Q_ASSERT( device && device->isWritable() );
+  m_errorString.clear();
+  m_truncated = false;
+  return writeHeader( commit, device ) && writeDiff( commit, device );
+}
+
+bool DiffRenderer::writeHeader( git_commit *commit, QIODevice *device )
+{
+  char sha1[GIT_OID_HEXSZ + 1];
+  git_oid_tostr( sha1, sizeof( sha1 ), git_commit_id( commit ) );
+
+  QByteArray header( "commit " );
+  header += sha1;
+  header += '\n';
+
+  const unsigned int parentCount = git_commit_parentcount( commit );
+  if ( parentCount > 1 ) {
+    header += "Merge:";
+    for ( unsigned int i = 0; i < parentCount; ++i ) {
+      char parentSha1[8];
+      git_oid_tostr( parentSha1, sizeof( parentSha1 ), git_commit_parent_id( commit, i ) );
+      header += ' ';
+      header += parentSha1;
+    }
+    header += '\n';
+  }
+
+  const git_signature *author = git_commit_author( commit );
+  header += "Author: ";
+  header += author->name;
+  header += " <";
+  header += author->email;
+  header += ">\nDate:   ";
+  header += formatDate( author->when );
+  header += "\n\n";
+
+  // Indent the message by four spaces, like git does
+  const QByteArray message = QByteArray( git_commit_message( commit ) ).trimmed();
+  foreach( const QByteArray &line, message.split( '\n' ) ) {
+    if ( !line.isEmpty() )
+      header += "    " + line;
+    header += '\n';
+  }
+  header += '\n';
+
+  if ( device->write( header ) != header.size() ) {
+    m_errorString = device->errorString();
+    return false;
+  }
+  return true;
+}
+
+bool DiffRenderer::writeDiff( git_commit *commit, QIODevice *device )
+{
+  // Like git show, merges don't get a diff against the first parent
+  if ( git_commit_parentcount( commit ) > 1 )
+    return true;
+
+  git_tree *tree = 0;
+  git_tree *parentTree = 0;
+  git_commit *parent = 0;
+  git_diff_list *diff = 0;
+  bool result = false;
+
+  if ( git_commit_tree( &tree, commit ) != GIT_OK ) {
+    m_errorString = lastGitError( "git_commit_tree" );
+  } else if ( git_commit_parentcount( commit ) == 1 &&
+              ( git_commit_parent( &parent, commit, 0 ) != GIT_OK ||
+                git_commit_tree( &parentTree, parent ) != GIT_OK ) ) {
+    m_errorString = lastGitError( "Error looking up the parent tree" );
+  } else if ( git_diff_tree_to_tree( &diff, m_repository, parentTree, tree, 0 ) != GIT_OK ) {
+    m_errorString = lastGitError( "git_diff_tree_to_tree" );
+  } else if ( git_diff_find_similar( diff, 0 ) != GIT_OK ) {
+    m_errorString = lastGitError( "git_diff_find_similar" );
+  } else {
+    result = writePatches( diff, device );
+  }
+
+  git_diff_list_free( diff );
+  git_tree_free( parentTree );
+  git_commit_free( parent );
+  git_tree_free( tree );
+  return result;
+}
+
+bool DiffRenderer::writePatches( git_diff_list *diff, QIODevice *device )
+{
+  PrintState state;
+  state.device = device;
+  state.limit = m_fileLimit;
+  state.error = false;
+
+  qint64 total = 0;
+  const size_t count = git_diff_num_deltas( diff );
+  size_t i = 0;
+  for ( ; i < count && ( m_totalLimit <= 0 || total < m_totalLimit ); ++i ) {
+    git_diff_patch *patch = 0;
+    const git_diff_delta *delta = 0;
+    if ( git_diff_get_patch( &patch, &delta, diff, i ) != GIT_OK ) {
+      m_errorString = lastGitError( "git_diff_get_patch" );
+      return false;
+    }
+
+    QByteArray summary;
+    state.written = 0;
+    state.skippedLines = 0;
+    if ( delta->flags & GIT_DIFF_FLAG_BINARY ) {
+      summary = "Binary file " + QByteArray( deltaPath( delta ) ) + " changed, " +
+                QByteArray::number( qint64( delta->old_file.size ) ) + " -> " +
+                QByteArray::number( qint64( delta->new_file.size ) ) + " bytes\n";
+    } else if ( isGenerated( deltaPath( delta ) ) ) {
+      size_t context, additions, deletions;
+      git_diff_patch_line_stats( &context, &additions, &deletions, patch );
+      summary = "Generated file " + QByteArray( deltaPath( delta ) ) + " changed, +" +
+                QByteArray::number( qulonglong( additions ) ) + " -" +
+                QByteArray::number( qulonglong( deletions ) ) + " lines, not shown\n";
+    } else if ( git_diff_patch_print( patch, printCallback, &state ) != GIT_OK ) {
+      m_errorString = state.error && !device->errorString().isEmpty() ? device->errorString()
+                                                                      : lastGitError( "git_diff_patch_print" );
+      git_diff_patch_free( patch );
+      return false;
+    } else if ( state.skippedLines > 0 ) {
+      m_truncated = true;
+      summary = "[... " + QByteArray::number( state.skippedLines ) + " more lines of " +
+                QByteArray( deltaPath( delta ) ) + " not shown ...]\n";
+    }
+    git_diff_patch_free( patch );
+
+    if ( !summary.isEmpty() && device->write( summary ) != summary.size() ) {
+      m_errorString = device->errorString();
+      return false;
+    }
+    total += state.written + summary.size();
+  }
+
+  if ( i < count ) {
+    m_truncated = true;
+    const QByteArray marker = "[... " + QByteArray::number( qulonglong( count - i ) ) +
+                              " more files not shown, the diff is too big ...]\n";
+    if ( device->write( marker ) != marker.size() ) {
+      m_errorString = device->errorString();
+      return false;
+    }
+  }
+  return true;
+}
+
+QString DiffRenderer::errorString() const
+{
+  return m_errorString;
+}
@@ -0,0 +1,81 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef DIFF_RENDERER_H_
+#define DIFF_RENDERER_H_
+
+#include <QList>
+#include <QRegExp>
+#include <QString>
+#include <QStringList>
+
+#include <git2/diff.h>
+#include <git2/types.h>
+
+class QIODevice;
+
+/**
+ * Renders a commit the way "git show" does, using an already opened repository.
+ *
+ * Output is written to the device as libgit2 produces it, so nothing but the
+ * device's own buffer holds the patch.
+ *
+ * The patch can be kept within a budget: binary files and files matching the
+ * generated file patterns are reduced to a line saying what changed, each file's
+ * patch is cut after a number of bytes, and once the whole diff is over budget
+ * the remaining files are only counted. Cuts are marked in the output.
+ */
+class DiffRenderer {
+public:
+  explicit DiffRenderer( git_repository *repository );
+
+  /**
+   * Limits, in bytes, for the whole diff and for each file. 0, the default, is no limit.
+   */
+  void setLimits( qint64 totalBytes, qint64 fileBytes );
+
+  /**
+   * Wildcard patterns, matched against the path and the file name.
+   */
+  void setGeneratedFilePatterns( const QStringList &patterns );
+
+  bool render( git_commit *commit, QIODevice *device );
+
+  /**
+   * Whether the last render() left something out because of the limits.
+   */
+  bool isTruncated() const;
+
+  QString errorString() const;
+
+private:
+  bool writeHeader( git_commit *commit, QIODevice *device );
+  bool writeDiff( git_commit *commit, QIODevice *device );
+  bool writePatches( git_diff_list *diff, QIODevice *device );
+  bool isGenerated( const char *path ) const;
+
+  git_repository *m_repository;
+  qint64 m_totalLimit;
+  qint64 m_fileLimit;
+  QList<QRegExp> m_generatedPatterns;
+  bool m_truncated;
+  QString m_errorString;
+};
+
+#endif
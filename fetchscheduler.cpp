@@ -0,0 +1,90 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "fetchscheduler.h"
+
+#include <KDebug>
+
+#include <QHash>
+#include <QTimer>
+
+#include <unistd.h>
+
+FetchScheduler::FetchScheduler( const QString &identifier, QObject *parent ) : QObject( parent )
+                                                                             , m_timer( new QTimer( this ) )
+                                                                             , m_minimum( 2 * 60 )
+                                                                             , m_maximum( 60 * 60 )
+                                                                             , m_interval( m_minimum )
+                                                                             , m_random( qHash( identifier ) ^ quint32( getpid() ) )
+                                                                             , m_enabled( false )
+{
+  m_timer->setSingleShot( true );
+  connect( m_timer, SIGNAL(timeout()), SIGNAL(fetchDue()) );
+}
+
+void FetchScheduler::setIntervals( int minimum, int maximum )
+{
+  m_minimum = qMax( 1, minimum ) * 60;
+  m_maximum = qMax( m_minimum, maximum * 60 );
+  m_interval = qBound( m_minimum, m_interval, m_maximum );
+}
+
+void FetchScheduler::setEnabled( bool enabled )
+{
+  m_enabled = enabled;
+  m_interval = m_minimum;
+  if ( enabled ) {
+    // Spread instances that start together over the whole first interval
+    m_random = m_random * 1103515245 + 12345;
+    schedule( ( m_random >> 8 ) % m_minimum );
+  } else {
+    m_timer->stop();
+  }
+}
+
+void FetchScheduler::fetchDone( bool newCommits )
+{
+  if ( newCommits )
+    m_interval = m_minimum;
+  else
+    m_interval = qMin( m_interval * 2, m_maximum );
+
+  kDebug() << "Next fetch in about" << m_interval << "seconds";
+  if ( m_enabled )
+    schedule( jittered( m_interval ) );
+}
+
+int FetchScheduler::interval() const
+{
+  return m_interval;
+}
+
+void FetchScheduler::schedule( int seconds )
+{
+  m_timer->start( seconds * 1000 );
+}
+
+int FetchScheduler::jittered( int seconds )
+{
+  m_random = m_random * 1103515245 + 12345;
+  const int range = seconds * JitterPercent / 100;
+  if ( range == 0 )
+    return seconds;
+  return seconds - range + int( ( m_random >> 8 ) % quint32( 2 * range + 1 ) );
+}
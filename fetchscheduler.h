@@ -0,0 +1,81 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef FETCH_SCHEDULER_H_
+#define FETCH_SCHEDULER_H_
+
+#include <QObject>
+#include <QString>
+
+class QTimer;
+
+/**
+ * Decides when the next fetch is due.
+ *
+ * The interval doubles, up to the maximum, every time a fetch brings nothing new,
+ * and drops back to the minimum when it does, so quiet upstreams are hardly polled
+ * and busy ones are followed closely. Every interval is randomized by +/- JitterPercent,
+ * with a generator seeded from the resource identifier, so instances started at
+ * the same time drift apart instead of fetching in lockstep.
+ */
+class FetchScheduler : public QObject {
+  Q_OBJECT
+public:
+  enum {
+    JitterPercent = 25
+  };
+
+  explicit FetchScheduler( const QString &identifier, QObject *parent = 0 );
+
+  /**
+   * Minimum and maximum interval, in minutes.
+   */
+  void setIntervals( int minimum, int maximum );
+
+  /**
+   * Schedules the first fetch, somewhere within the minimum interval. Disabling stops fetching.
+   */
+  void setEnabled( bool enabled );
+
+  /**
+   * Reports the outcome of the fetch triggered by fetchDue() and schedules the next one.
+   */
+  void fetchDone( bool newCommits );
+
+  /**
+   * The current interval, in seconds, without jitter.
+   */
+  int interval() const;
+
+Q_SIGNALS:
+  void fetchDue();
+
+private:
+  void schedule( int seconds );
+  int jittered( int seconds );
+
+  QTimer *m_timer;
+  int m_minimum;
+  int m_maximum;
+  int m_interval;
+  quint32 m_random;
+  bool m_enabled;
+};
+
+#endif
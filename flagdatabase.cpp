@@ -18,6 +18,8 @@
 */
 
 #include "flagdatabase.h"
+#include "gitoid.h"
+#include "flagwriter.h"
 
 #include <KStandardDirs>
 #include <KDebug>
@@ -26,89 +28,309 @@
 #include <QSqlQuery>
 #include <QVariant>
 #include <QSqlError>
+#include <QVector>
+#include <QHash>
 #include <QFile>
 
+typedef quint32 FlagMask;
+
 enum {
-  Sha1Column = 0,
-  FlagColumn
+  MaxFlags = sizeof( FlagMask ) * 8
 };
 
 class FlagDatabase::Private
 {
 public:
-  Private( const QString &identifier )
+  Private( const QString &identifier ) : m_writer( 0 )
   {
-    m_database = QSqlDatabase::addDatabase( "QSQLITE" );
+    const QString connectionName = QLatin1String( "flags-" ) + identifier;
     const QString filename = KStandardDirs::locateLocal( "data",
                                                          identifier + QLatin1String( "/flags.db" ) );
-    m_database.setDatabaseName( filename );
-    if ( !QFile::exists( filename ) ) {
-      createDB();
-    } else {
-      m_database.open(); //TODO error
+    {
+      // Only used while loading, from then on everything goes through m_writer
+      m_database = QSqlDatabase::addDatabase( "QSQLITE", connectionName );
+      m_database.setDatabaseName( filename );
+      if ( m_database.open() ) {
+        createTables();
+        migrateOldTable();
+        load();
+      } else {
+        kError() << "Error opening flags database" << m_database.lastError();
+      }
+      m_database.close();
+      m_database = QSqlDatabase();
     }
+    QSqlDatabase::removeDatabase( connectionName );
+
+    m_writer = new FlagWriter( filename, connectionName + QLatin1String( "-writer" ) );
+    m_writer->start( QThread::LowPriority );
   }
 
   ~Private()
   {
-    m_database.close();
+    // Flushes pending writes
+    delete m_writer;
   }
 
-  void createDB();
+  void createTables();
+  void migrateOldTable();
+  void load();
+
+  FlagMask maskForFlag( const QByteArray &flag );
+  FlagMask maskForFlags( const Akonadi::Item::Flags &flags );
+  bool store( const QString &sha1, FlagMask mask );
+
   QSqlDatabase m_database;
+  FlagWriter *m_writer;
+
+  // Flags are interned, a flag's id is its bit in the mask
+  QVector<QByteArray> m_flagNames;
+  QHash<QByteArray,int> m_flagIds;
+  QHash<git_oid,FlagMask> m_masks;
 };
 
-void FlagDatabase::Private::createDB()
+void FlagDatabase::Private::createTables()
 {
-  //TODO better error control
-  if ( m_database.open() ) {
-    QSqlQuery query;
-    if ( !query.exec( "create table flags "
-                     "(sha1 varchar(40) primary key, flag varchar(10) ) " ) ) {
-      kError() << "Error creating table. " << query.lastError();
+  // One row per commit with all its flags, instead of the old ( sha1 primary key, flag ) table,
+  // which could only hold one flag per commit.
+  QSqlQuery query( m_database );
+  if ( !query.exec( "create table if not exists flag_names "
+                    "(id integer primary key, name text unique not null)" ) ||
+       !query.exec( "create table if not exists commit_flags "
+                    "(oid blob primary key, mask integer not null)" ) ) {
+    kError() << "Error creating tables. " << query.lastError();
+  }
+}
+
+void FlagDatabase::Private::migrateOldTable()
+{
+  if ( !m_database.tables().contains( QLatin1String( "flags" ) ) )
+    return;
+
+  // Load the new tables first, so the old flags are merged with them
+  load();
+
+  m_database.transaction();
+  QSqlQuery query( m_database );
+  query.exec( "select sha1, flag from flags" );
+  QHash<QString,FlagMask> masks;
+  while ( query.next() ) {
+    masks[query.value( 0 ).toString()] |= maskForFlag( query.value( 1 ).toString().toUtf8() );
+  }
+
+  QHash<QString,FlagMask>::const_iterator it = masks.constBegin();
+  for ( ; it != masks.constEnd(); ++it )
+    store( it.key(), it.value() );
+
+  if ( !query.exec( "drop table flags" ) || !m_database.commit() ) {
+    kError() << "Error migrating flags" << m_database.lastError();
+    m_database.rollback();
+  }
+}
+
+void FlagDatabase::Private::load()
+{
+  m_flagNames.clear();
+  m_flagIds.clear();
+  m_masks.clear();
+
+  QSqlQuery query( m_database );
+  query.setForwardOnly( true );
+  query.exec( "select id, name from flag_names order by id" );
+  while ( query.next() ) {
+    const int id = query.value( 0 ).toInt();
+    const QByteArray name = query.value( 1 ).toByteArray();
+    if ( id != m_flagNames.count() || id >= MaxFlags ) {
+      kError() << "Unexpected flag id" << id << name;
+      continue;
     }
+    m_flagNames << name;
+    m_flagIds.insert( name, id );
+  }
+
+  query.exec( "select oid, mask from commit_flags" );
+  while ( query.next() ) {
+    const QByteArray raw = query.value( 0 ).toByteArray();
+    if ( raw.size() != GIT_OID_RAWSZ )
+      continue;
+    git_oid oid;
+    git_oid_fromraw( &oid, reinterpret_cast<const unsigned char*>( raw.constData() ) );
+    m_masks.insert( oid, query.value( 1 ).toUInt() );
+  }
+}
+
+FlagMask FlagDatabase::Private::maskForFlag( const QByteArray &flag )
+{
+  QHash<QByteArray,int>::const_iterator it = m_flagIds.constFind( flag );
+  if ( it != m_flagIds.constEnd() )
+    return FlagMask( 1 ) << it.value();
+
+  const int id = m_flagNames.count();
+  if ( id >= MaxFlags ) {
+    kError() << "Too many distinct flags, ignoring" << flag;
+    return 0;
+  }
+
+  if ( m_writer ) {
+    m_writer->addFlagName( id, flag );
   } else {
-    kError() << "Error opening seen database" << m_database.lastError();
+    QSqlQuery query( m_database );
+    query.prepare( "insert into flag_names (id, name) values (?, ?)" );
+    query.addBindValue( id );
+    query.addBindValue( QString::fromUtf8( flag ) );
+    if ( !query.exec() ) {
+      kError() << "Error inserting flag" << flag << query.lastError();
+      return 0;
+    }
   }
+
+  m_flagNames << flag;
+  m_flagIds.insert( flag, id );
+  return FlagMask( 1 ) << id;
+}
+
+FlagMask FlagDatabase::Private::maskForFlags( const Akonadi::Item::Flags &flags )
+{
+  FlagMask mask = 0;
+  foreach( const QByteArray &flag, flags )
+    mask |= maskForFlag( flag );
+  return mask;
+}
+
+bool FlagDatabase::Private::store( const QString &sha1, FlagMask mask )
+{
+  git_oid oid;
+  if ( !GitOid::fromString( sha1, &oid ) ) {
+    kError() << "Invalid sha1" << sha1;
+    return false;
+  }
+
+  if ( mask == 0 ) {
+    m_masks.remove( oid );
+  } else {
+    m_masks.insert( oid, mask );
+  }
+
+  if ( m_writer ) {
+    m_writer->setMask( oid, mask );
+    return true;
+  }
+
+  const QByteArray raw( reinterpret_cast<const char*>( oid.id ), GIT_OID_RAWSZ );
+  QSqlQuery query( m_database );
+  if ( mask == 0 ) {
+    query.prepare( "delete from commit_flags where oid = ?" );
+    query.addBindValue( raw );
+  } else {
+    query.prepare( "insert or replace into commit_flags (oid, mask) values (?, ?)" );
+    query.addBindValue( raw );
+    query.addBindValue( mask );
+  }
+
+  if ( !query.exec() ) {
+    kError() << "Error storing flags for" << sha1 << query.lastError();
+    return false;
+  }
+  return true;
 }
 
 bool FlagDatabase::insertFlag( const QString &sha1, const QString &flag )
 {
-  QSqlQuery query;
-  return query.exec( "insert into flags VALUES ('" + sha1 + "', '" + flag + "')" );
+  git_oid oid;
+  if ( !GitOid::fromString( sha1, &oid ) )
+    return false;
+  return d->store( sha1, d->m_masks.value( oid ) | d->maskForFlag( flag.toUtf8() ) );
 }
 
 bool FlagDatabase::deleteFlag( const QString &sha1, const QString &flag )
 {
-  QSqlQuery query;
-  return query.exec( "delete from flags where sha1 = '" + sha1 + "' and flag ='" + flag + "'" );
+  git_oid oid;
+  if ( !GitOid::fromString( sha1, &oid ) )
+    return false;
+  const int id = d->m_flagIds.value( flag.toUtf8(), -1 );
+  if ( id == -1 )
+    return true;
+  return d->store( sha1, d->m_masks.value( oid ) & ~( FlagMask( 1 ) << id ) );
 }
 
 bool FlagDatabase::deleteFlags( const QString& sha1 )
 {
-  QSqlQuery query;
-  return query.exec( "delete from flags where sha1 = '" + sha1 + "'" );
+  return d->store( sha1, 0 );
+}
+
+bool FlagDatabase::setFlags( const QString &sha1, const Akonadi::Item::Flags &flags )
+{
+  return d->store( sha1, d->maskForFlags( flags ) );
+}
+
+bool FlagDatabase::changeFlags( const QStringList &sha1s, const Akonadi::Item::Flags &added,
+                                const Akonadi::Item::Flags &removed )
+{
+  const FlagMask addedMask = d->maskForFlags( added );
+  FlagMask removedMask = 0;
+  foreach( const QByteArray &flag, removed ) {
+    const int id = d->m_flagIds.value( flag, -1 );
+    if ( id != -1 )
+      removedMask |= FlagMask( 1 ) << id;
+  }
+
+  QHash<git_oid,FlagMask> changes;
+  bool result = true;
+  foreach( const QString &sha1, sha1s ) {
+    git_oid oid;
+    if ( !GitOid::fromString( sha1, &oid ) ) {
+      result = false;
+      continue;
+    }
+    const FlagMask oldMask = d->m_masks.value( oid );
+    const FlagMask newMask = ( oldMask | addedMask ) & ~removedMask;
+    if ( newMask == oldMask )
+      continue;
+
+    if ( newMask == 0 ) {
+      d->m_masks.remove( oid );
+    } else {
+      d->m_masks.insert( oid, newMask );
+    }
+    changes.insert( oid, newMask );
+  }
+
+  // Handed over at once, so they're written in the same transaction
+  d->m_writer->setMasks( changes );
+  return result;
 }
 
 bool FlagDatabase::exists( const QString sha1, const QString &flag ) const
 {
-  QSqlQuery query;
-  query.exec( "select 1 from flags where sha1 = '" + sha1 + "' and flag ='" + flag + "'" );
-  return query.isValid();
+  git_oid oid;
+  const int id = d->m_flagIds.value( flag.toUtf8(), -1 );
+  if ( id == -1 || !GitOid::fromString( sha1, &oid ) )
+    return false;
+  return d->m_masks.value( oid ) & ( FlagMask( 1 ) << id );
 }
 
 bool FlagDatabase::clear()
 {
-  QSqlQuery query;
-  return query.exec( "delete from flags" );
+  d->m_masks.clear();
+  d->m_writer->clear();
+  return true;
 }
 
 Akonadi::Item::Flags FlagDatabase::flags( const QString &sha1 ) const
+{
+  git_oid oid;
+  if ( !GitOid::fromString( sha1, &oid ) )
+    return Akonadi::Item::Flags();
+  return flags( oid );
+}
+
+Akonadi::Item::Flags FlagDatabase::flags( const git_oid &oid ) const
 {
   Akonadi::Item::Flags flags;
-  QSqlQuery query( QString( "SELECT flag FROM flags WHERE sha1 = '%1'" ).arg( sha1 ) );
-  while( query.next() ) {
-    flags << query.value( 0 ).toString().toUtf8();
+  const FlagMask mask = d->m_masks.value( oid );
+  for ( int id = 0; id < d->m_flagNames.count(); ++id ) {
+    if ( mask & ( FlagMask( 1 ) << id ) )
+      flags << d->m_flagNames.at( id );
   }
   return flags;
 }
@@ -22,7 +22,17 @@
 
 #include <Akonadi/Item>
 #include <QString>
+#include <QStringList>
 
+#include <git2/oid.h>
+
+/**
+ * Stores the flags of each commit.
+ *
+ * The whole table is loaded once, into a hash keyed by binary oid with the flags
+ * as a bitmask, so flags() doesn't touch the database. Writes update the hash
+ * right away and reach the database later, through a FlagWriter thread.
+ */
 class FlagDatabase {
 public:
   FlagDatabase( const QString &identifier );
@@ -31,8 +41,17 @@ public:
   bool insertFlag( const QString &sha1, const QString &flag );
   bool deleteFlag( const QString &sha1, const QString &flag );
   bool deleteFlags( const QString &sha1 );
+  bool setFlags( const QString &sha1, const Akonadi::Item::Flags &flags );
+
+  /**
+   * Adds @p added and removes @p removed from each commit in @p sha1s.
+   * The changes reach the database in a single transaction.
+   */
+  bool changeFlags( const QStringList &sha1s, const Akonadi::Item::Flags &added,
+                    const Akonadi::Item::Flags &removed );
   bool exists( const QString sha1, const QString &flag ) const;
   Akonadi::Item::Flags flags( const QString &sha1 ) const;
+  Akonadi::Item::Flags flags( const git_oid &oid ) const;
 
   bool clear();
 private:
@@ -0,0 +1,190 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "flagwriter.h"
+
+#include <KDebug>
+
+#include <QElapsedTimer>
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+
+enum {
+  WriteDelay = 250 // ms, to coalesce bursts of changes into one transaction
+};
+
+FlagWriter::FlagWriter( const QString &fileName, const QString &connectionName,
+                        QObject *parent ) : QThread( parent )
+                                          , m_fileName( fileName )
+                                          , m_connectionName( connectionName )
+                                          , m_pendingClear( false )
+                                          , m_stop( false )
+{
+}
+
+FlagWriter::~FlagWriter()
+{
+  stop();
+  wait();
+}
+
+void FlagWriter::addFlagName( int id, const QByteArray &name )
+{
+  QMutexLocker locker( &m_mutex );
+  m_pendingNames << qMakePair( id, name );
+  m_waitCondition.wakeOne();
+}
+
+void FlagWriter::setMask( const git_oid &oid, quint32 mask )
+{
+  QMutexLocker locker( &m_mutex );
+  m_pendingMasks.insert( oid, mask );
+  m_waitCondition.wakeOne();
+}
+
+void FlagWriter::setMasks( const QHash<git_oid,quint32> &masks )
+{
+  if ( masks.isEmpty() )
+    return;
+
+  QMutexLocker locker( &m_mutex );
+  if ( m_pendingMasks.isEmpty() ) {
+    m_pendingMasks = masks;
+  } else {
+    // Not unite(), the newer mask has to replace the pending one
+    QHash<git_oid,quint32>::const_iterator it = masks.constBegin();
+    for ( ; it != masks.constEnd(); ++it )
+      m_pendingMasks.insert( it.key(), it.value() );
+  }
+  m_waitCondition.wakeOne();
+}
+
+void FlagWriter::clear()
+{
+  QMutexLocker locker( &m_mutex );
+  m_pendingMasks.clear();
+  m_pendingClear = true;
+  m_waitCondition.wakeOne();
+}
+
+void FlagWriter::stop()
+{
+  QMutexLocker locker( &m_mutex );
+  m_stop = true;
+  m_waitCondition.wakeOne();
+}
+
+bool FlagWriter::hasPendingChanges() const
+{
+  return m_pendingClear || !m_pendingNames.isEmpty() || !m_pendingMasks.isEmpty();
+}
+
+void FlagWriter::run()
+{
+  {
+    QSqlDatabase database = QSqlDatabase::addDatabase( "QSQLITE", m_connectionName );
+    database.setDatabaseName( m_fileName );
+    if ( !database.open() )
+      kError() << "Error opening flags database" << database.lastError();
+
+    forever {
+      QMutexLocker locker( &m_mutex );
+      while ( !hasPendingChanges() && !m_stop )
+        m_waitCondition.wait( &m_mutex );
+
+      // Give the rest of a burst some time to arrive. Each change wakes us up, so
+      // wait for the deadline rather than for the next wake up
+      QElapsedTimer timer;
+      timer.start();
+      while ( !m_stop && timer.elapsed() < WriteDelay )
+        m_waitCondition.wait( &m_mutex, WriteDelay - timer.elapsed() );
+
+      const QList<QPair<int,QByteArray> > names = m_pendingNames;
+      const QHash<git_oid,quint32> masks = m_pendingMasks;
+      const bool clear = m_pendingClear;
+      const bool stop = m_stop;
+      m_pendingNames.clear();
+      m_pendingMasks.clear();
+      m_pendingClear = false;
+      locker.unlock();
+
+      if ( clear || !names.isEmpty() || !masks.isEmpty() )
+        write( names, masks, clear );
+
+      if ( stop )
+        break;
+    }
+
+    database.close();
+  }
+  QSqlDatabase::removeDatabase( m_connectionName );
+}
+
+void FlagWriter::write( const QList<QPair<int,QByteArray> > &names,
+                        const QHash<git_oid,quint32> &masks, bool clear )
+{
+  QSqlDatabase database = QSqlDatabase::database( m_connectionName );
+  database.transaction();
+
+  QSqlQuery query( database );
+  QSqlError error;
+  bool ok = true;
+  if ( clear )
+    ok = query.exec( "delete from commit_flags" );
+
+  if ( ok && !names.isEmpty() ) {
+    ok = query.prepare( "insert or replace into flag_names (id, name) values (?, ?)" );
+    for ( int i = 0; ok && i < names.count(); ++i ) {
+      query.bindValue( 0, names.at( i ).first );
+      query.bindValue( 1, QString::fromUtf8( names.at( i ).second ) );
+      ok = query.exec();
+    }
+  }
+  if ( !ok )
+    error = query.lastError();
+
+  if ( ok && !masks.isEmpty() ) {
+    QSqlQuery replaceQuery( database );
+    QSqlQuery deleteQuery( database );
+    ok = replaceQuery.prepare( "insert or replace into commit_flags (oid, mask) values (?, ?)" ) &&
+         deleteQuery.prepare( "delete from commit_flags where oid = ?" );
+
+    QHash<git_oid,quint32>::const_iterator it = masks.constBegin();
+    for ( ; ok && it != masks.constEnd(); ++it ) {
+      const QByteArray raw( reinterpret_cast<const char*>( it.key().id ), GIT_OID_RAWSZ );
+      if ( it.value() == 0 ) {
+        deleteQuery.bindValue( 0, raw );
+        ok = deleteQuery.exec();
+      } else {
+        replaceQuery.bindValue( 0, raw );
+        replaceQuery.bindValue( 1, it.value() );
+        ok = replaceQuery.exec();
+      }
+    }
+    if ( !ok )
+      error = deleteQuery.lastError().isValid() ? deleteQuery.lastError() : replaceQuery.lastError();
+  }
+
+  if ( !ok || !database.commit() ) {
+    kError() << "Error writing flags" << error << database.lastError();
+    database.rollback();
+  }
+}
@@ -0,0 +1,79 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef FLAGWRITER_H_
+#define FLAGWRITER_H_
+
+#include "gitoid.h"
+
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QMutex>
+#include <QThread>
+#include <QString>
+#include <QWaitCondition>
+
+/**
+ * Writes flag changes to flags.db from a thread of its own, with its own connection.
+ *
+ * Changes are coalesced per commit, so only the last mask of each one is written,
+ * and every batch is committed as a single transaction. Pending changes are
+ * written before the thread stops.
+ */
+class FlagWriter : public QThread {
+  Q_OBJECT
+public:
+  FlagWriter( const QString &fileName, const QString &connectionName, QObject *parent = 0 );
+  ~FlagWriter();
+
+  void addFlagName( int id, const QByteArray &name );
+  void setMask( const git_oid &oid, quint32 mask );
+  void setMasks( const QHash<git_oid,quint32> &masks );
+
+  /**
+   * Removes all commits' flags, including pending changes.
+   */
+  void clear();
+
+  /**
+   * Writes what's pending and stops the thread.
+   */
+  void stop();
+
+protected:
+  void run();
+
+private:
+  bool hasPendingChanges() const;
+  void write( const QList<QPair<int,QByteArray> > &names,
+              const QHash<git_oid,quint32> &masks, bool clear );
+
+  const QString m_fileName;
+  const QString m_connectionName;
+
+  QList<QPair<int,QByteArray> > m_pendingNames;
+  QHash<git_oid,quint32> m_pendingMasks;
+  bool m_pendingClear;
+  bool m_stop;
+  QMutex m_mutex;
+  QWaitCondition m_waitCondition;
+};
+
+#endif
@@ -0,0 +1,265 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "gitjob.h"
+#include "gitoid.h"
+
+#include <QMutexLocker>
+
+#include <git2/oid.h>
+#include <git2/commit.h>
+#include <git2/signature.h>
+
+#include <string.h>
+
+GitJob::GitJob( Type type, const QString &sha1, QObject *parent ) : QObject( parent )
+                                                                  , m_type( type )
+                                                                  , m_sha1( sha1 )
+                                                                  , m_readAhead( 0 )
+                                                                  , m_position( 0 )
+                                                                  , m_maxBytes( 0 )
+                                                                  , m_renderedBytes( 0 )
+                                                                  , m_duration( 0 )
+                                                                  , m_resultCode( ResultSuccess )
+{
+  Q_ASSERT( !( type == GitJob::GetAllCommits && !sha1.isEmpty() ) );
+}
+
+GitJob::Type GitJob::type() const
+{
+  return m_type;
+}
+
+QString GitJob::sha1() const
+{
+  return m_sha1;
+}
+
+int GitJob::CommitList::count() const
+{
+  return m_commits.count();
+}
+
+bool GitJob::CommitList::isEmpty() const
+{
+  return m_commits.isEmpty();
+}
+
+void GitJob::CommitList::clear()
+{
+  m_commits.clear();
+  m_authors.clear();
+  m_authorIds.clear();
+  m_subjects.clear();
+}
+
+const GitJob::Commit &GitJob::CommitList::at( int index ) const
+{
+  return m_commits.at( index );
+}
+
+void GitJob::CommitList::add( git_commit *commit, quint32 branches )
+{
+  Q_ASSERT( commit );
+  const char *message = git_commit_message( commit );
+  const char *newLine = strchr( message, '\n' );
+  const git_signature *author = git_commit_author( commit );
+  add( *git_commit_id( commit ), git_commit_time( commit ),
+       QByteArray( author ? author->email : "" ), message,
+       newLine ? int( newLine - message ) : int( strlen( message ) ), branches );
+}
+
+void GitJob::CommitList::add( const git_oid &oid, qint64 time, const QByteArray &email,
+                              const char *subject, int subjectLength, quint32 branches )
+{
+  Commit commit;
+  commit.oid = oid;
+  commit.time = time;
+  commit.author = internAuthor( email );
+  commit.subjectOffset = m_subjects.size();
+  commit.subjectLength = subjectLength;
+  commit.branches = branches;
+  m_subjects.append( subject, subjectLength );
+  m_commits.append( commit );
+}
+
+void GitJob::CommitList::append( const CommitList &other )
+{
+  if ( isEmpty() ) {
+    *this = other;
+    return;
+  }
+
+  const quint32 subjectBase = m_subjects.size();
+  m_subjects += other.m_subjects;
+  m_commits.reserve( m_commits.count() + other.m_commits.count() );
+  foreach( Commit commit, other.m_commits ) {
+    commit.author = internAuthor( other.m_authors.at( commit.author ) );
+    commit.subjectOffset += subjectBase;
+    m_commits.append( commit );
+  }
+}
+
+void GitJob::CommitList::add( const CommitList &other, int index )
+{
+  const Commit &commit = other.m_commits.at( index );
+  add( commit.oid, commit.time, other.m_authors.at( commit.author ),
+       other.m_subjects.constData() + commit.subjectOffset, commit.subjectLength, commit.branches );
+}
+
+quint32 GitJob::CommitList::internAuthor( const QByteArray &email )
+{
+  QHash<QByteArray,quint32>::const_iterator it = m_authorIds.constFind( email );
+  if ( it != m_authorIds.constEnd() )
+    return it.value();
+
+  m_authors.append( email );
+  m_authorIds.insert( email, m_authors.count() - 1 );
+  return m_authors.count() - 1;
+}
+
+QString GitJob::CommitList::sha1( int index ) const
+{
+  return GitOid::toString( m_commits.at( index ).oid );
+}
+
+QString GitJob::CommitList::author( int index ) const
+{
+  return QString::fromUtf8( m_authors.at( m_commits.at( index ).author ) );
+}
+
+QString GitJob::CommitList::subject( int index ) const
+{
+  const Commit &commit = m_commits.at( index );
+  return QString::fromUtf8( m_subjects.constData() + commit.subjectOffset, commit.subjectLength );
+}
+
+QDateTime GitJob::CommitList::dateTime( int index ) const
+{
+  return QDateTime::fromMSecsSinceEpoch( m_commits.at( index ).time * 1000 );
+}
+
+void GitJob::setBranches( const QStringList &branches )
+{
+  Q_ASSERT( branches.count() <= 32 );
+  m_branches = branches;
+}
+
+QStringList GitJob::branches() const
+{
+  return m_branches;
+}
+
+void GitJob::setLastSyncedHeads( const QHash<QString,QByteArray> &heads )
+{
+  m_lastSyncedHeads = heads;
+}
+
+void GitJob::setReadAhead( int count )
+{
+  m_readAhead = count;
+}
+
+void GitJob::setSha1List( const QStringList &sha1List )
+{
+  m_sha1List = sha1List;
+}
+
+QStringList GitJob::sha1List() const
+{
+  return m_sha1List;
+}
+
+void GitJob::setMaxBytes( qint64 bytes )
+{
+  m_maxBytes = bytes;
+}
+
+void GitJob::setFileName( const QString &fileName )
+{
+  m_fileName = fileName;
+}
+
+QString GitJob::fileName() const
+{
+  return m_fileName;
+}
+
+void GitJob::setError( ResultCode code, const QString &errorString )
+{
+  QMutexLocker locker( &m_mutex );
+  m_resultCode = code;
+  m_errorString = errorString;
+}
+
+QString GitJob::lastErrorString() const
+{
+  QMutexLocker locker( &m_mutex );
+  return m_errorString;
+}
+
+GitJob::ResultCode GitJob::lastErrorCode() const
+{
+  QMutexLocker locker( &m_mutex );
+  return m_resultCode;
+}
+
+GitJob::CommitList GitJob::commits() const
+{
+  QMutexLocker locker( &m_mutex );
+  return m_commits;
+}
+
+GitJob::CommitList GitJob::takeCommits()
+{
+  QMutexLocker locker( &m_mutex );
+  const CommitList commits = m_commits;
+  m_commits.clear();
+  return commits;
+}
+
+void GitJob::appendCommits( const CommitList &commits )
+{
+  QMutexLocker locker( &m_mutex );
+  m_commits.append( commits );
+}
+
+qint64 GitJob::duration() const
+{
+  QMutexLocker locker( &m_mutex );
+  return m_duration;
+}
+
+QList<QByteArray> GitJob::bodies() const
+{
+  QMutexLocker locker( &m_mutex );
+  return m_bodies;
+}
+
+QHash<QString,QByteArray> GitJob::heads() const
+{
+  QMutexLocker locker( &m_mutex );
+  return m_heads;
+}
+
+bool GitJob::isIncremental( const QString &branch ) const
+{
+  QMutexLocker locker( &m_mutex );
+  return m_incrementalBranches.contains( branch );
+}
@@ -0,0 +1,228 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef AKONADI_GIT_JOB_H_
+#define AKONADI_GIT_JOB_H_
+
+#include <QMutex>
+#include <QSet>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QDateTime>
+#include <QStringList>
+
+#include <git2/oid.h>
+#include <git2/types.h>
+
+/**
+ * A unit of work for GitThread.
+ *
+ * Jobs are created on the main thread, queued with GitThread::enqueue() and
+ * filled in by the worker. finished() is emitted from the worker thread, so
+ * connections to main thread objects are queued.
+ */
+class GitJob : public QObject {
+  Q_OBJECT
+  friend class GitThread;
+public:
+
+  enum Type {
+    GetAllCommits,
+    GetMessage, // Commit metadata and the rendered body, in one go, plus read-ahead
+    Fetch, // Fetches branches() from origin
+    FullPatch, // Renders the commit without any size limit into fileName()
+    Prefetch // Renders the messages of sha1List(), see GitThread::enqueueBackground()
+  };
+
+  enum ResultCode {
+    ResultSuccess,
+    ResultErrorOpeningRepository,
+    ResultErrorCommitLookup,
+    ResultErrorRevwalkPush,
+    ResultErrorRevwalkNew,
+    ResultErrorRepositoryHead,
+    ResultNothingToFetch,
+    ResultErrorDiffing,
+    ResultErrorInvalidHead,
+    ResultErrorPulling,
+  };
+
+  /**
+   * What listing needs from a commit, 48 bytes on x86-64 and no allocations of its own.
+   * Strings live in the CommitList it belongs to.
+   */
+  struct Commit {
+    git_oid oid;
+    qint64 time;           // commit time, seconds since the epoch
+    quint32 author;        // index in the list's author table
+    quint32 subjectOffset; // in the list's subject buffer
+    quint32 subjectLength;
+    quint32 branches;      // bit i set if it's new to branches().at( i ), only for GetAllCommits
+  };
+
+  /**
+   * Commits sharing an author table and a buffer with their subjects, UTF-8 encoded.
+   * The full message isn't kept, it's part of the rendered body.
+   */
+  class CommitList {
+  public:
+    int count() const;
+    bool isEmpty() const;
+    void clear();
+    const Commit &at( int index ) const;
+
+    void add( git_commit *commit, quint32 branches = 0 );
+    void add( const git_oid &oid, qint64 time, const QByteArray &email,
+              const char *subject, int subjectLength, quint32 branches );
+    void append( const CommitList &other );
+
+    /**
+     * Appends the commit at @p index of @p other.
+     */
+    void add( const CommitList &other, int index );
+
+    QString sha1( int index ) const;
+    QString author( int index ) const;
+    QString subject( int index ) const;
+    QDateTime dateTime( int index ) const;
+
+  private:
+    quint32 internAuthor( const QByteArray &email );
+
+    QVector<Commit> m_commits;
+    QVector<QByteArray> m_authors;
+    QHash<QByteArray,quint32> m_authorIds;
+    QByteArray m_subjects;
+  };
+
+  GitJob( Type type, const QString &sha1 = QString(), QObject *parent = 0 );
+
+  Type type() const;
+  QString sha1() const;
+
+  /**
+   * The remote branches to walk, at most 32, or the wildcard patterns of those to fetch.
+   */
+  void setBranches( const QStringList &branches );
+  QStringList branches() const;
+
+  /**
+   * Only report commits that aren't reachable from the branch's last synced head.
+   * Must be called before enqueueing. Only applies to GetAllCommits.
+   */
+  void setLastSyncedHeads( const QHash<QString,QByteArray> &heads );
+
+  /**
+   * Also look up to @p count first parent ancestors of the requested commit, and
+   * list the ones the filters accept in sha1List(). Only applies to GetMessage.
+   */
+  void setReadAhead( int count );
+
+  /**
+   * The commits to render, most wanted first. Only applies to Prefetch.
+   * After a GetMessage, the read-ahead commits, for a Prefetch to render.
+   */
+  void setSha1List( const QStringList &sha1List );
+  QStringList sha1List() const;
+
+  /**
+   * Stop rendering once bodies() add up to @p bytes, 0 for no limit.
+   * Only applies to Prefetch.
+   */
+  void setMaxBytes( qint64 bytes );
+
+  /**
+   * Where FullPatch writes the patch. Replaced atomically.
+   */
+  void setFileName( const QString &fileName );
+  QString fileName() const;
+
+  QString lastErrorString() const;
+  ResultCode lastErrorCode() const;
+
+  /**
+   * The time the worker spent on the job, in ms, not counting the time it was queued.
+   */
+  qint64 duration() const;
+  CommitList commits() const;
+
+  /**
+   * Returns the commits GetAllCommits walked since the last call, and forgets them.
+   * See commitsAvailable().
+   */
+  CommitList takeCommits();
+
+  /**
+   * The rendered message bodies, one per commit in commits().
+   */
+  QList<QByteArray> bodies() const;
+
+  /**
+   * Returns the heads that were walked by GetAllCommits, by branch.
+   * Branches whose head couldn't be resolved are missing.
+   */
+  QHash<QString,QByteArray> heads() const;
+
+  /**
+   * Returns true if only the commits since the branch's last synced head were walked.
+   */
+  bool isIncremental( const QString &branch ) const;
+
+Q_SIGNALS:
+  /**
+   * GetAllCommits walked another chunk of commits, get them with takeCommits().
+   * Queued emissions might be coalesced, so take everything there is.
+   */
+  void commitsAvailable();
+
+  /**
+   * Progress of a Fetch job, 0 to 100.
+   */
+  void fetchProgress( int percent );
+  void finished();
+
+private:
+  void setError( ResultCode code, const QString &errorString );
+  void appendCommits( const CommitList &commits );
+
+  const Type m_type;
+  const QString m_sha1;
+  QStringList m_branches;
+  QHash<QString,QByteArray> m_lastSyncedHeads;
+  int m_readAhead;
+  QStringList m_sha1List;
+  int m_position; // in m_sha1List, a Prefetch carries on from there after yielding
+  qint64 m_maxBytes;
+  qint64 m_renderedBytes;
+  qint64 m_duration;
+  QString m_fileName;
+
+  CommitList m_commits;
+  QList<QByteArray> m_bodies;
+  QHash<QString,QByteArray> m_heads;
+  QSet<QString> m_incrementalBranches;
+  QString m_errorString;
+  ResultCode m_resultCode;
+  mutable QMutex m_mutex;
+};
+
+#endif
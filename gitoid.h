@@ -0,0 +1,64 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef AKONADI_GIT_OID_H_
+#define AKONADI_GIT_OID_H_
+
+// Helpers to use libgit2's binary oids as Qt container keys
+
+#include <QHash>
+#include <QString>
+#include <QByteArray>
+
+#include <git2/oid.h>
+#include <git2/errors.h>
+
+#include <string.h>
+
+inline bool operator==( const git_oid &a, const git_oid &b )
+{
+  return git_oid_cmp( &a, &b ) == 0;
+}
+
+inline uint qHash( const git_oid &oid )
+{
+  // Already uniformly distributed
+  uint hash;
+  memcpy( &hash, oid.id, sizeof( hash ) );
+  return hash;
+}
+
+namespace GitOid {
+  /**
+   * Parses a 40 character hex sha1. Returns false if it isn't one.
+   */
+  inline bool fromString( const QString &sha1, git_oid *out )
+  {
+    return sha1.length() == GIT_OID_HEXSZ && git_oid_fromstr( out, sha1.toLatin1().constData() ) == GIT_OK;
+  }
+
+  inline QString toString( const git_oid &oid )
+  {
+    char sha1[GIT_OID_HEXSZ + 1];
+    git_oid_tostr( sha1, sizeof( sha1 ), &oid );
+    return QString::fromLatin1( sha1, GIT_OID_HEXSZ );
+  }
+}
+
+#endif
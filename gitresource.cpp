@@ -23,8 +23,14 @@
 #include "settingsadaptor.h"
 #include "configdialog.h"
 #include "gitthread.h"
+#include "itembuilder.h"
 #include "flagdatabase.h"
+#include "messagecache.h"
 #include "cheatingutils.h"
+#include "fetchscheduler.h"
+#include "patchservice.h"
+#include "refwatcher.h"
+#include "statistics.h"
 
 #include <akonadi/agentfactory.h>
 #include <Akonadi/ItemFetchScope>
@@ -37,54 +43,182 @@
 #include <KPIMIdentities/IdentityManager>
 
 #include <KCalCore/Event>
+#include <KConfig>
+#include <KConfigGroup>
 #include <KLocale>
+#include <KStandardDirs>
 #include <KWindowSystem>
 
+#include <QElapsedTimer>
+#include <QFile>
 #include <QFileInfo>
-#include <QFileSystemWatcher>
+#include <QRegExp>
+#include <QSet>
 
 using namespace Akonadi;
 
 enum {
-  IntervalCheckTime = 5 // minutes
+  IntervalCheckTime = 30, // minutes, only a safety net, fetches are scheduled and refs watched
+  MaxBranches = 32, // Branch masks are 32 bits
+  DeliveryChunkSize = 500 // Items handed to Akonadi at once
+};
+
+static const char *RootRemoteId = "git_resource_root";
+
+
+// What a shared walk found for the other branches, kept until their retrieveItems()
+// asks for it. The branch that started the walk gets its commits as they're found.
+struct WalkResult {
+  WalkResult() : streamed( false ), position( 0 ) {}
+
+  QStringList branches;
+  GitJob::CommitList commits;
+  QHash<QString,QByteArray> heads;
+  QSet<QString> incremental;
+  QSet<QString> pending;
+
+  QString streaming; // the branch that started the walk
+  bool streamed;     // something was delivered for it already
+
+  QString delivering; // the pending branch being delivered in chunks
+  int position;       // where in commits delivering continues
+
+  QStringList fresh;  // newest commits streamed, to prefetch if the walk was incremental
+
+  void clear()
+  {
+    branches.clear();
+    commits.clear();
+    heads.clear();
+    incremental.clear();
+    pending.clear();
+    streaming.clear();
+    streamed = false;
+    delivering.clear();
+    position = 0;
+    fresh.clear();
+  }
 };
 
 class GitResource::Private {
 public:
   Private( GitResource *qq ) : mSettings( new GitSettings( componentData().config() ) )
-                             , m_thread( 0 )
-                             , m_diffThread( 0 )
+                             , m_worker( 0 )
+                             , m_fetchWorker( 0 )
+                             , m_job( 0 )
+                             , m_fetchJob( 0 )
+                             , m_prefetchJob( 0 )
+                             , m_fetchScheduler( 0 )
                              , m_watcher( 0 )
                              , m_flagsDatabase( 0 )
+                             , m_messageCache( 0 )
+                             , m_statistics( new Statistics( qq ) )
+                             , m_itemBuilder( 0 )
                              , q( qq )
   {
     setupWatcher();
     m_flagsDatabase = new FlagDatabase( q->identifier() );
+    m_itemBuilder = new ItemBuilder( m_flagsDatabase );
+    m_itemBuilder->setIdentity( mSettings->identity() );
+    m_worker = new GitThread( mSettings, KStandardDirs::locateLocal( "data", q->identifier() + QLatin1String( "/index/" ) ) );
+    m_fetchWorker = new GitThread( mSettings, QString() );
+    m_messageCache = new MessageCache( q->identifier(), qint64( mSettings->messageCacheSize() ) * 1024 * 1024 );
+    m_fetchScheduler = new FetchScheduler( q->identifier(), q );
+    connect( m_fetchScheduler, SIGNAL(fetchDue()), q, SLOT(fetch()) );
   }
 
   ~Private()
   {
+    delete m_worker;
+    delete m_fetchWorker;
+    delete m_messageCache;
+    delete m_itemBuilder;
     delete m_flagsDatabase;
   }
 
   QString repositoryName() const;
 
   void setupWatcher();
-  Akonadi::Item commitToItem( const GitThread::Commit &commit,
-                              const QByteArray &diff = QByteArray() ) const;
-
+  void setupFetchScheduler();
   void updateResourceName();
 
+  // The remote branches we have a collection for
+  QStringList branches() const;
+  QHash<QString,QByteArray> currentHeads() const;
+
+  // The head of each branch's last successful sync, stored next to flags.db
+  QString syncStateFileName() const;
+  QHash<QString,QByteArray> syncedHeads() const;
+  void setSyncedHead( const QString &branch, const QByteArray &sha1 );
+  void clearSyncedHeads();
+
+  void deliverItems( const QString &branch );
+  void streamCommits( const GitJob::CommitList &commits );
+  void deliver( const QString &branch, const Akonadi::Item::List &items );
+  void prefetch( const QStringList &sha1List );
+  void recordConversion( const QElapsedTimer &timer );
+  void recordFlagLookups();
+  void startRetrieval( const Akonadi::Item &item );
+  void recordRetrieval();
+  void recordRender( GitJob *job );
+
   GitSettings *mSettings;
-  GitThread   *m_thread;
-  GitThread   *m_diffThread;
-  QFileSystemWatcher *m_watcher;
+  GitThread   *m_worker;
+  GitThread   *m_fetchWorker; // A fetch can take minutes, listings and retrievals don't wait for it
+  GitJob      *m_job; // The job for the current task, if any
+  GitJob      *m_fetchJob; // Fetches run outside of tasks
+  GitJob      *m_prefetchJob; // So do prefetches, in the worker's background queue
+  QStringList m_pendingPrefetch; // Commits of syncs done while m_prefetchJob ran
+  FetchScheduler *m_fetchScheduler;
+  RefWatcher *m_watcher;
   FlagDatabase *m_flagsDatabase;
-  QByteArray m_currentHead;
+  MessageCache *m_messageCache;
+  Statistics *m_statistics;
+  ItemBuilder *m_itemBuilder;
+  QElapsedTimer m_retrieveTimer; // since the current retrieveItem() task came in
+
+  // The current task, when it came in while m_job or a chunked delivery was busy.
+  // Started by startPendingTask()
+  Akonadi::Item m_pendingItem;
+  Akonadi::Collection m_pendingCollection;
+  QHash<QString,QByteArray> m_currentHeads;
+  WalkResult m_walkResult;
 private:
   GitResource *q;
 };
 
+void GitResource::Private::prefetch( const QStringList &sha1List )
+{
+  // Without a cache there's nowhere to keep the results
+  if ( mSettings->messageCacheSize() <= 0 )
+    return;
+
+  QStringList wanted;
+  foreach( const QString &sha1, sha1List ) {
+    if ( !m_messageCache->contains( sha1 ) )
+      wanted << sha1;
+  }
+
+  // A running one gets to finish, these are newer so they go first after it
+  if ( m_prefetchJob ) {
+    foreach( const QString &sha1, m_pendingPrefetch ) {
+      if ( !wanted.contains( sha1 ) )
+        wanted << sha1;
+    }
+    m_pendingPrefetch = wanted.mid( 0, mSettings->prefetchCount() );
+    return;
+  }
+
+  if ( wanted.isEmpty() )
+    return;
+
+  m_prefetchJob = new GitJob( GitJob::Prefetch, QString(), q );
+  m_prefetchJob->setSha1List( wanted );
+  m_prefetchJob->setMaxBytes( qint64( mSettings->prefetchSize() ) * 1024 * 1024 );
+  connect( m_prefetchJob, SIGNAL(finished()), q, SLOT(handlePrefetchFinished()) );
+  m_worker->enqueueBackground( m_prefetchJob );
+}
+
 void GitResource::Private::updateResourceName()
 {
   const QString repName = repositoryName();
@@ -93,45 +227,197 @@ void GitResource::Private::updateResourceName()
 
 void GitResource::Private::setupWatcher()
 {
-  delete m_watcher;
-  m_watcher = new QFileSystemWatcher( q );
-  connect( m_watcher, SIGNAL(fileChanged(QString)), q, SLOT(handleRepositoryChanged()) );
-  if ( !mSettings->repository().isEmpty() ) {
-    m_watcher->addPath( mSettings->repository() + QLatin1String( "/.git/refs/remotes/origin/master" ) );
+  if ( !m_watcher ) {
+    m_watcher = new RefWatcher( q );
+    connect( m_watcher, SIGNAL(refsChanged()), q, SLOT(handleRepositoryChanged()) );
   }
+
+  m_watcher->setGitDir( mSettings->repository().isEmpty() ? QString()
+                                                          : mSettings->repository() + QLatin1String( "/.git" ) );
+}
+
+void GitResource::Private::setupFetchScheduler()
+{
+  m_fetchScheduler->setIntervals( mSettings->minFetchInterval(), mSettings->maxFetchInterval() );
+  m_fetchScheduler->setEnabled( mSettings->doGitFetch() && !mSettings->repository().isEmpty() );
+}
+
+
+
+QStringList GitResource::Private::branches() const
+{
+  if ( mSettings->repository().isEmpty() )
+    return QStringList();
+
+  QList<QRegExp> patterns;
+  foreach( const QString &pattern, mSettings->branches() )
+    patterns << QRegExp( pattern, Qt::CaseSensitive, QRegExp::Wildcard );
+
+  QStringList branches;
+  const QStringList remoteBranches =
+    CheatingUtils::remoteBranches( mSettings->repository() + QLatin1String( "/.git/" ) );
+  foreach( const QString &branch, remoteBranches ) {
+    foreach( const QRegExp &pattern, patterns ) {
+      if ( pattern.exactMatch( branch ) ) {
+        branches << branch;
+        break;
+      }
+    }
+  }
+
+  // Old clones might only have origin/HEAD
+  if ( branches.isEmpty() && mSettings->branches().contains( QLatin1String( "master" ) ) )
+    branches << QLatin1String( "master" );
+
+  if ( branches.count() > MaxBranches ) {
+    kWarning() << "Too many branches, only using the first" << MaxBranches;
+    branches = branches.mid( 0, MaxBranches );
+  }
+  return branches;
+}
+
+QHash<QString,QByteArray> GitResource::Private::currentHeads() const
+{
+  QHash<QString,QByteArray> heads;
+  const QString repoPath = mSettings->repository() + QLatin1String( "/.git/" );
+  foreach( const QString &branch, branches() )
+    heads.insert( branch, CheatingUtils::getRemoteHead( repoPath, branch ) );
+  return heads;
+}
+
+QString GitResource::Private::syncStateFileName() const
+{
+  return KStandardDirs::locateLocal( "data", q->identifier() + QLatin1String( "/syncstate" ) );
+}
+
+QHash<QString,QByteArray> GitResource::Private::syncedHeads() const
+{
+  QHash<QString,QByteArray> heads;
+  KConfig config( syncStateFileName(), KConfig::SimpleConfig );
+  const KConfigGroup group( &config, "Heads" );
+  foreach( const QString &branch, group.keyList() )
+    heads.insert( branch, group.readEntry( branch, QByteArray() ) );
+  return heads;
+}
+
+void GitResource::Private::setSyncedHead( const QString &branch, const QByteArray &sha1 )
+{
+  KConfig config( syncStateFileName(), KConfig::SimpleConfig );
+  KConfigGroup group( &config, "Heads" );
+  group.writeEntry( branch, sha1 );
+  config.sync();
+}
+
+void GitResource::Private::clearSyncedHeads()
+{
+  KConfig config( syncStateFileName(), KConfig::SimpleConfig );
+  config.deleteGroup( "Heads" );
+  config.sync();
+}
+
+void GitResource::Private::deliver( const QString &branch, const Akonadi::Item::List &items )
+{
+  QElapsedTimer timer;
+  timer.start();
+  if ( m_walkResult.incremental.contains( branch ) ) {
+    // Commits are immutable, so there's nothing to change or remove
+    q->itemsRetrievedIncremental( items, Akonadi::Item::List() );
+  } else {
+    q->itemsRetrieved( items );
+  }
+  m_statistics->addDuration( Statistics::Delivery, timer.elapsed() );
+  m_statistics->addItems( items.count() );
+}
+
+void GitResource::Private::recordConversion( const QElapsedTimer &timer )
+{
+  m_statistics->addDuration( Statistics::Conversion, timer.elapsed() );
+  recordFlagLookups();
+}
+
+void GitResource::Private::recordFlagLookups()
+{
+  m_statistics->addDuration( Statistics::FlagLookup, m_itemBuilder->takeFlagLookupTime() / 1000000 );
+}
+
+void GitResource::Private::recordRetrieval()
+{
+  m_statistics->addRetrieveLatency( m_retrieveTimer.elapsed() );
 }
 
-Akonadi::Item GitResource::Private::commitToItem( const GitThread::Commit &commit,
-                                                  const QByteArray &body ) const
+void GitResource::Private::recordRender( GitJob *job )
 {
-  Item item;
-  item.setMimeType( KMime::Message::mimeType() );
+  m_statistics->addDuration( Statistics::Render, job->duration() );
+  foreach( const QByteArray &body, job->bodies() )
+    m_statistics->addRenderedBytes( body.size() );
+}
 
-  KMime::Message *message = new KMime::Message();
-  KMime::Headers::ContentType *ct = message->contentType();
-  ct->setMimeType( "text/plain" );
-  message->contentTransferEncoding()->clear();
-  const QByteArray firstLine = commit.message.split('\n').first();
+void GitResource::Private::streamCommits( const GitJob::CommitList &commits )
+{
+  if ( commits.isEmpty() )
+    return;
+
+  // Heads and incremental state are set before the first chunk is emitted
+  if ( m_walkResult.branches.isEmpty() ) {
+    m_walkResult.branches = m_job->branches();
+    foreach( const QString &branch, m_walkResult.branches ) {
+      if ( m_job->isIncremental( branch ) )
+        m_walkResult.incremental.insert( branch );
+    }
+  }
 
-  message->subject()->fromUnicodeString( firstLine, "utf-8" );
-  message->from()->fromUnicodeString( commit.author, "utf-8" );
-  message->to()->fromUnicodeString( mSettings->identity(), "utf-8" );
-  // message->cc()->fromUnicodeString( "some@mailaddy.com", "utf-8" ); // parse CCMAIL:
-  message->date()->setDateTime( KDateTime( commit.dateTime ) );
-  item.setPayload( KMime::Message::Ptr( message ) );
+  QElapsedTimer timer;
+  timer.start();
+  m_statistics->addCommits( commits.count() );
+  const int bit = m_walkResult.branches.indexOf( m_walkResult.streaming );
+  const quint32 mask = bit == -1 ? 0 : quint32( 1 ) << bit;
+  Akonadi::Item::List items;
+  const int prefetchCount = mSettings->prefetchCount();
+  for ( int i = 0; i < commits.count(); ++i ) {
+    if ( commits.at( i ).branches & mask ) {
+      items << m_itemBuilder->envelope( commits, i );
+      if ( m_walkResult.fresh.count() < prefetchCount )
+        m_walkResult.fresh << commits.sha1( i );
+    }
+    // Only what the other branches need is kept, history they share with this one included
+    if ( commits.at( i ).branches & ~mask )
+      m_walkResult.commits.add( commits, i );
+  }
+  recordConversion( timer );
 
-  message->contentType()->setMimeType( "text/plain" );
-  message->contentType()->setCharset( "UTF-8" );
+  if ( !items.isEmpty() ) {
+    deliver( m_walkResult.streaming, items );
+    m_walkResult.streamed = true;
+  }
+}
 
-  if ( !body.isEmpty() ) {
-    message->setBody( body );
+void GitResource::Private::deliverItems( const QString &branch )
+{
+  Q_ASSERT( m_walkResult.pending.contains( branch ) );
+  if ( !m_walkResult.heads.contains( branch ) ) {
+    m_walkResult.pending.remove( branch );
+    q->cancelTask( i18n( "Can't find the head of origin/%1", branch ) );
+    if ( m_walkResult.pending.isEmpty() )
+      m_walkResult.clear();
+    return;
   }
 
-  item.setRemoteId( commit.sha1 );
-  message->assemble();
+  const quint32 mask = quint32( 1 ) << m_walkResult.branches.indexOf( branch );
+  int count = 0;
+  for ( int i = 0; i < m_walkResult.commits.count(); ++i ) {
+    if ( m_walkResult.commits.at( i ).branches & mask )
+      ++count;
+  }
 
-  item.setFlags( m_flagsDatabase->flags( commit.sha1 ) );
-  return item;
+  // Small listings go in one go, big ones in chunks, returning to the event loop in
+  // between so Akonadi can store each chunk before the next one is built
+  m_walkResult.delivering = branch;
+  m_walkResult.position = 0;
+  if ( count > DeliveryChunkSize ) {
+    q->setItemStreamingEnabled( true );
+    q->setTotalItems( count );
+  }
+  q->deliverNextChunk();
 }
 
 QString GitResource::Private::repositoryName() const
@@ -156,6 +442,12 @@ GitResource::GitResource( const QString &id )
   DBusConnectionPool::threadConnection().registerObject( QLatin1String( "/Settings" ),
                                                          d->mSettings,
                                                          QDBusConnection::ExportAdaptors );
+  DBusConnectionPool::threadConnection().registerObject( QLatin1String( "/Patches" ),
+                                                         new PatchService( d->m_worker, identifier(), this ),
+                                                         QDBusConnection::ExportScriptableSlots );
+  DBusConnectionPool::threadConnection().registerObject( QLatin1String( "/Statistics" ),
+                                                         d->m_statistics,
+                                                         QDBusConnection::ExportScriptableContents );
   //connect( this, SIGNAL(reloadConfiguration()), SLOT(load()) );
   //load();
   if ( !d->mSettings->from().isValid() ) {
@@ -169,10 +461,13 @@ GitResource::GitResource( const QString &id )
     d->mSettings->setIdentity( identity.fullEmailAddr() );
     d->mSettings->writeConfig();
   }
+  d->m_itemBuilder->setIdentity( d->mSettings->identity() );
 
   d->updateResourceName();
-  d->m_currentHead = CheatingUtils::getRemoteHead( d->mSettings->repository() +
-                                                   QLatin1String( "/.git/" ) );
+  d->m_currentHeads = d->currentHeads();
+  d->setupFetchScheduler();
+  // Superseded by the per-branch heads in syncstate
+  QFile::remove( KStandardDirs::locateLocal( "data", identifier() + QLatin1String( "/lastsyncedhead" ) ) );
 }
 
 GitResource::~GitResource()
@@ -194,11 +489,36 @@ void GitResource::configure( WId windowId )
     if ( d->mSettings->repository() != oldRepo ) {
       d->m_flagsDatabase->clear();
     }
+    // Filters might have changed, do a full sync
+    d->clearSyncedHeads();
+    // A walk of the old branches with the old filters is left to finish on its own,
+    // its results are dropped. synchronize() walks again
+    const bool walking = d->m_job && d->m_job->type() == GitJob::GetAllCommits;
+    if ( walking ) {
+      d->m_job = 0;
+      emit status( Idle, i18n( "Ready" ) );
+    }
+    if ( walking || !d->m_walkResult.delivering.isEmpty() )
+      cancelTask( i18n( "The configuration changed" ) );
+    d->m_walkResult.clear();
+    QMetaObject::invokeMethod( this, "startPendingTask", Qt::QueuedConnection );
     d->updateResourceName();
     d->setupWatcher();
-    Collection collection;
-    collection.setRemoteId( QLatin1String( "master" ) );
-    invalidateCache( collection );
+    d->m_fetchWorker->cancelFetch(); // It might be fetching from the old repository or branches
+    d->m_worker->reloadConfiguration();
+    d->m_fetchWorker->reloadConfiguration();
+    d->setupFetchScheduler();
+    // The identity or the filters might have changed
+    d->m_itemBuilder->setIdentity( d->mSettings->identity() );
+    d->m_messageCache->clear();
+    d->m_pendingPrefetch.clear();
+    d->m_messageCache->setMaxSize( qint64( d->mSettings->messageCacheSize() ) * 1024 * 1024 );
+    d->m_currentHeads = d->currentHeads();
+    foreach( const QString &branch, d->branches() ) {
+      Collection collection;
+      collection.setRemoteId( branch );
+      invalidateCache( collection );
+    }
     synchronizeCollectionTree();
     synchronize();
   } else {
@@ -216,161 +536,354 @@ void GitResource::retrieveCollections()
                                                     << Akonadi::Collection::mimeType() );
   rootCollection.setRights( Collection::ReadOnly );
   rootCollection.setParentCollection( Akonadi::Collection::root() );
-  rootCollection.setRemoteId( QLatin1String( "git_resource_root" ) );
+  rootCollection.setRemoteId( QLatin1String( RootRemoteId ) );
 
   EntityDisplayAttribute *const evendDisplayAttribute = new EntityDisplayAttribute();
   evendDisplayAttribute->setIconName( "git" );
   rootCollection.addAttribute( evendDisplayAttribute );
 
-  Collection master;
-  master.setName( QLatin1String( "master" ) );
-  master.setParentCollection( rootCollection );
-  master.setRemoteId( QLatin1String( "master" ) ); // TODO: support more branches
-  master.setContentMimeTypes( QStringList() << KMime::Message::mimeType()
-                                            << Akonadi::Collection::mimeType() );
-  master.setRights( Collection::ReadOnly );
+  Collection::List collections;
+  collections << rootCollection;
 
   Akonadi::CachePolicy policy;
   policy.setIntervalCheckTime( IntervalCheckTime );
   policy.setInheritFromParent( false );
   policy.setSyncOnDemand( true );
-  master.setCachePolicy( policy );
 
-  collectionsRetrieved( Collection::List() << rootCollection << master );
+  foreach( const QString &branch, d->branches() ) {
+    Collection collection;
+    // Collection names can't contain slashes, the display name can
+    collection.setName( QString( branch ).replace( QLatin1Char( '/' ), QLatin1Char( '_' ) ) );
+    collection.setParentCollection( rootCollection );
+    collection.setRemoteId( branch );
+    collection.setContentMimeTypes( QStringList() << KMime::Message::mimeType()
+                                                  << Akonadi::Collection::mimeType() );
+    collection.setRights( Collection::ReadOnly );
+    collection.setCachePolicy( policy );
+
+    EntityDisplayAttribute *const displayAttribute = new EntityDisplayAttribute();
+    displayAttribute->setDisplayName( branch );
+    collection.addAttribute( displayAttribute );
+
+    collections << collection;
+  }
+
+  collectionsRetrieved( collections );
 }
 
 void GitResource::retrieveItems( const Akonadi::Collection &collection )
 {
-  Q_UNUSED( collection );
-  if ( collection.remoteId() == QLatin1String( "master" ) ) {
-    if ( !d->m_thread ) {
-      d->m_thread = new GitThread( d->mSettings, GitThread::GetAllCommits );
-      connect( d->m_thread, SIGNAL(finished()), SLOT(handleGetAllFinished()) );
-      connect( d->m_thread, SIGNAL(gitFetchDone()), SLOT(handleGitFetch()) );
-      emit status( Running, i18n( "Retrieving items..." ) );
-      d->m_watcher->blockSignals( true ); // We don't want signals during the git fetch
-      d->m_thread->start();
-    } else {
-      cancelTask( i18n( "A retrieveItems() task is already running." ) );
-    }
-  } else {
+  const QString branch = collection.remoteId();
+  if ( branch == QLatin1String( RootRemoteId ) ) {
     itemsRetrieved( Akonadi::Item::List() );
+  } else if ( d->m_walkResult.pending.contains( branch ) && d->m_walkResult.delivering.isEmpty() ) {
+    // Already walked together with another branch
+    d->deliverItems( branch );
+  } else if ( !d->m_job && d->m_walkResult.delivering.isEmpty() ) {
+    // Whatever is left from the last walk is walked again
+    d->m_walkResult.clear();
+    d->m_walkResult.streaming = branch;
+    setItemStreamingEnabled( true );
+
+    d->m_job = new GitJob( GitJob::GetAllCommits, QString(), this );
+    d->m_job->setBranches( d->branches() );
+    d->m_job->setLastSyncedHeads( d->syncedHeads() );
+    connect( d->m_job, SIGNAL(commitsAvailable()), SLOT(handleCommitsAvailable()) );
+    connect( d->m_job, SIGNAL(finished()), SLOT(handleGetAllFinished()) );
+    emit status( Running, i18n( "Retrieving items..." ) );
+    d->m_worker->enqueue( d->m_job );
+  } else {
+    // Deferring would have the scheduler hand it straight back while the job runs
+    d->m_pendingCollection = collection;
   }
 }
 
 bool GitResource::retrieveItem( const Item &item, const QSet<QByteArray> &parts )
 {
   Q_UNUSED( parts );
-  if ( !d->m_thread ) {
-    d->m_thread = new GitThread( d->mSettings, GitThread::GetOneCommit, item.remoteId() );
-    connect( d->m_thread, SIGNAL(finished()), SLOT(handleGetOneFinished()) );
-    emit status( Running, i18n( "Retrieving item..." ) );
-    d->m_thread->setProperty( "item", QVariant::fromValue<Akonadi::Item>( item ) );
-    d->m_thread->start();
-    return true;
+  // There's one task at a time, so a new one means the last one is over. Waiting
+  // for a busy worker is part of the latency, startPendingTask() doesn't restart it
+  d->m_retrieveTimer.start();
+  d->startRetrieval( item );
+  return true;
+}
+
+void GitResource::Private::startRetrieval( const Akonadi::Item &item )
+{
+  // Commits don't change, so a message rendered before is as good as a new one
+  const QByteArray cached = m_messageCache->message( item.remoteId() );
+  if ( !cached.isEmpty() ) {
+    KMime::Message::Ptr message( new KMime::Message() );
+    message->setContent( cached );
+    message->parse();
+
+    Akonadi::Item newItem( item );
+    newItem.setPayload<KMime::Message::Ptr>( message );
+    q->itemRetrieved( newItem );
+    m_statistics->addCacheLookup( true );
+    recordRetrieval();
+  } else if ( !m_job ) {
+    m_statistics->addCacheLookup( false );
+    m_job = new GitJob( GitJob::GetMessage, item.remoteId(), q );
+    m_job->setReadAhead( mSettings->readAhead() );
+    connect( m_job, SIGNAL(finished()), q, SLOT(handleGetMessageFinished()) );
+    emit q->status( Running, i18n( "Retrieving item..." ) );
+    m_job->setProperty( "item", QVariant::fromValue<Akonadi::Item>( item ) );
+    m_worker->enqueue( m_job );
   } else {
-    cancelTask( i18n( "A retrieveItem() task is already running." ) );
-    return false;
+    // Deferring would have the scheduler hand it straight back while the job runs
+    m_pendingItem = item;
+  }
+}
+
+void GitResource::startPendingTask()
+{
+  if ( d->m_job || !d->m_walkResult.delivering.isEmpty() )
+    return;
+
+  if ( d->m_pendingItem.isValid() ) {
+    const Akonadi::Item item = d->m_pendingItem;
+    d->m_pendingItem = Akonadi::Item();
+    d->startRetrieval( item );
+  } else if ( d->m_pendingCollection.isValid() ) {
+    const Akonadi::Collection collection = d->m_pendingCollection;
+    d->m_pendingCollection = Akonadi::Collection();
+    retrieveItems( collection );
   }
 }
 
+void GitResource::handleCommitsAvailable()
+{
+  // Might have been coalesced with the next ones, or come after finished() was handled
+  if ( d->m_job && d->m_job == sender() )
+    d->streamCommits( d->m_job->takeCommits() );
+}
+
 void GitResource::handleGetAllFinished()
 {
   kDebug() << "GitResource::handleGetAllFinished()";
-  d->m_thread->deleteLater();
+  GitJob *job = qobject_cast<GitJob*>( sender() );
+  if ( job != d->m_job ) {
+    // Given up on by configure()
+    job->deleteLater();
+    return;
+  }
+  d->m_job->deleteLater();
   emit status( Idle, i18n( "Ready" ) );
-  if ( d->m_thread->lastErrorCode() == GitThread::ResultSuccess ) {
-    Akonadi::Item::List items;
-    const QVector<GitThread::Commit> commits = d->m_thread->commits();
-    const QDateTime currentDateTime = QDateTime::currentDateTime();
-    foreach( const GitThread::Commit &commit, commits ) {
-      const bool fromScripty = commit.author == QLatin1String( "scripty@kde.org" );
-      if ( commit.dateTime.date() >= d->mSettings->from().date() &&
-           !( fromScripty && !d->mSettings->scripty() ) ) {
-        items << d->commitToItem( commit );
-      }
-    }
-    itemsRetrieved( items ); // TODO: make it incremental?
+  d->streamCommits( d->m_job->takeCommits() );
+  d->m_statistics->addDuration( Statistics::Walk, d->m_job->duration() );
+
+  const QString branch = d->m_walkResult.streaming;
+  if ( d->m_job->lastErrorCode() != GitJob::ResultSuccess ) {
+    d->m_walkResult.clear();
+    cancelTask( i18n( "Error while doing retrieveItems(): %1", d->m_job->lastErrorString() ) );
+  } else if ( !d->m_job->heads().contains( branch ) ) {
+    d->m_walkResult.clear();
+    cancelTask( i18n( "Can't find the head of origin/%1", branch ) );
   } else {
-    cancelTask( i18n( "Error while doing retrieveItems(): %s ", d->m_thread->lastErrorString() ) );
+    // Old and filtered commits were already left out by the walk
+    d->m_walkResult.branches = d->m_job->branches();
+    d->m_walkResult.heads = d->m_job->heads();
+    d->m_walkResult.incremental.clear();
+    foreach( const QString &walkedBranch, d->m_walkResult.branches ) {
+      if ( d->m_job->isIncremental( walkedBranch ) )
+        d->m_walkResult.incremental.insert( walkedBranch );
+    }
+
+    // Nothing new still has to say whether it was a full or an incremental listing
+    if ( !d->m_walkResult.streamed )
+      d->deliver( branch, Akonadi::Item::List() );
+    itemsRetrievalDone();
+    d->setSyncedHead( branch, d->m_walkResult.heads.value( branch ) );
+
+    // What landed since the last sync is what gets read next
+    if ( d->m_walkResult.incremental.contains( branch ) )
+      d->prefetch( d->m_walkResult.fresh );
+
+    d->m_walkResult.pending = d->m_walkResult.branches.toSet();
+    d->m_walkResult.pending.remove( branch );
+    // Branches that moved while walking are walked again when they're asked for
+    foreach( const QString &walkedBranch, d->m_walkResult.branches ) {
+      if ( d->m_walkResult.heads.value( walkedBranch ) != d->m_currentHeads.value( walkedBranch ) )
+        d->m_walkResult.pending.remove( walkedBranch );
+    }
+    d->m_walkResult.streaming.clear();
+    if ( d->m_walkResult.pending.isEmpty() )
+      d->m_walkResult.clear();
   }
-  d->m_thread = 0;
+  d->m_job = 0;
+  QMetaObject::invokeMethod( this, "startPendingTask", Qt::QueuedConnection );
 }
 
-void GitResource::handleGetOneFinished()
+void GitResource::deliverNextChunk()
 {
-  kDebug() << "GitResource::handleGetOneFinished()";
-  emit status( Idle, i18n( "Ready" ) );
-  if ( d->m_thread->lastErrorCode() == GitThread::ResultSuccess ) {
-    Akonadi::Item item( d->m_thread->property( "item" ).value<Akonadi::Item>() );
-    d->m_diffThread = new GitThread( d->mSettings, GitThread::GetDiff, item.remoteId() );
-    connect( d->m_diffThread, SIGNAL(finished()), SLOT(handleGetDiffFinished()) );
-    d->m_diffThread->start();
+  const QString branch = d->m_walkResult.delivering;
+  if ( branch.isEmpty() )
+    return;
+
+  const quint32 mask = quint32( 1 ) << d->m_walkResult.branches.indexOf( branch );
+  const GitJob::CommitList &commits = d->m_walkResult.commits;
+  QElapsedTimer timer;
+  timer.start();
+  Akonadi::Item::List items;
+  int &position = d->m_walkResult.position;
+  for ( ; position < commits.count() && items.count() < DeliveryChunkSize; ++position ) {
+    if ( commits.at( position ).branches & mask )
+      items << d->m_itemBuilder->envelope( commits, position );
+  }
+
+  // Skip to the branch's next commit, so the last chunk is known to be the last one
+  while ( position < commits.count() && !( commits.at( position ).branches & mask ) )
+    ++position;
+  d->recordConversion( timer );
+
+  // In chunks, the last one completes the task, as setTotalItems() was called
+  d->deliver( branch, items );
+
+  if ( position < commits.count() ) {
+    QMetaObject::invokeMethod( this, "deliverNextChunk", Qt::QueuedConnection );
   } else {
-    kError() << "GitResource::handleGetOneFinished() error: " << d->m_thread->lastErrorString()
-             << d->m_thread->lastErrorCode();
-    d->m_thread = 0;
-    cancelTask( i18n( "Error while doing retrieveItem(): %s ", d->m_thread->lastErrorString() ) );
+    d->setSyncedHead( branch, d->m_walkResult.heads.value( branch ) );
+    d->m_walkResult.pending.remove( branch );
+    d->m_walkResult.delivering.clear();
+    if ( d->m_walkResult.pending.isEmpty() )
+      d->m_walkResult.clear();
+    QMetaObject::invokeMethod( this, "startPendingTask", Qt::QueuedConnection );
   }
 }
 
-void GitResource::handleGetDiffFinished()
+void GitResource::handleGetMessageFinished()
 {
-  kDebug() << "GitResource::handleGetDiffFinished()";
-  d->m_diffThread->deleteLater();
-  d->m_thread->deleteLater();
-
-  const QVector<GitThread::Commit> commits = d->m_thread->commits();
-  Q_ASSERT( commits.count() == 1 );
-  const GitThread::Commit commit = commits.first();
-  const QString lastErrorString = d->m_diffThread->lastErrorString();
-  const GitThread::ResultCode lastErrorCode = d->m_diffThread->lastErrorCode();
-  Akonadi::Item item( d->m_thread->property( "item" ).value<Akonadi::Item>() );
-  const QByteArray diff = d->m_diffThread->diff();
-
-  d->m_thread = 0;
-  d->m_diffThread = 0;
+  kDebug() << "GitResource::handleGetMessageFinished()";
+  d->m_job->deleteLater();
+  emit status( Idle, i18n( "Ready" ) );
 
-  if ( lastErrorCode == GitThread::ResultSuccess ) {
-    Q_ASSERT( !diff.isEmpty() );
-    item.setPayload<KMime::Message::Ptr>( d->commitToItem( commit,
-                                                           diff ).payload<KMime::Message::Ptr>() );
+  const QString lastErrorString = d->m_job->lastErrorString();
+  const GitJob::ResultCode lastErrorCode = d->m_job->lastErrorCode();
+  Akonadi::Item item( d->m_job->property( "item" ).value<Akonadi::Item>() );
+  const GitJob::CommitList commits = d->m_job->commits();
+  const QList<QByteArray> bodies = d->m_job->bodies();
+  const QStringList readAhead = d->m_job->sha1List();
+  d->recordRender( d->m_job );
+  d->m_job = 0;
+
+  if ( lastErrorCode == GitJob::ResultSuccess ) {
+    Q_ASSERT( commits.count() == 1 && bodies.count() == 1 );
+    Q_ASSERT( !bodies.first().isEmpty() );
+    item.setPayload<KMime::Message::Ptr>( d->m_itemBuilder->item( commits, 0,
+                                                                   bodies.first() ).payload<KMime::Message::Ptr>() );
     itemRetrieved( item );
+    d->recordRetrieval();
+    d->m_messageCache->insert( commits.sha1( 0 ), item.payload<KMime::Message::Ptr>()->encodedContent() );
+    d->recordFlagLookups();
+
+    // The older commits are usually requested next, but not waited on like this one
+    d->prefetch( readAhead );
   } else {
-    kError() << "GitResource::handleGetDiffFinished()" << lastErrorString;
+    kError() << "GitResource::handleGetMessageFinished()" << lastErrorString << lastErrorCode;
     cancelTask( lastErrorString );
   }
+  QMetaObject::invokeMethod( this, "startPendingTask", Qt::QueuedConnection );
 }
 
 void GitResource::itemChanged( const Akonadi::Item &item, const QSet<QByteArray> &parts )
 {
   Q_UNUSED( parts );
-  const QString sha1 = item.remoteId();
-  d->m_flagsDatabase->deleteFlags( sha1 );
-  foreach( const QByteArray &flag, item.flags() ) {
-    d->m_flagsDatabase->insertFlag( sha1, QString::fromUtf8( flag ) );
-  }
+  d->m_flagsDatabase->setFlags( item.remoteId(), item.flags() );
   // TODO: error handling
   changeCommitted( item );
 }
 
+void GitResource::itemsFlagsChanged( const Akonadi::Item::List &items,
+                                     const QSet<QByteArray> &addedFlags,
+                                     const QSet<QByteArray> &removedFlags )
+{
+  // Mark all as read and friends arrive here in one go instead of one itemChanged() per item
+  QStringList sha1s;
+  sha1s.reserve( items.count() );
+  foreach( const Akonadi::Item &item, items )
+    sha1s << item.remoteId();
+
+  d->m_flagsDatabase->changeFlags( sha1s, addedFlags, removedFlags );
+  changesCommitted( items );
+}
+
 void GitResource::handleRepositoryChanged()
 {
-  const QByteArray newHead = CheatingUtils::getRemoteHead( d->mSettings->repository() +
-                                                           QLatin1String( "/.git/" ) );
-  if ( newHead != d->m_currentHead && !newHead.isEmpty() ) {
-    d->m_currentHead = newHead;
-    Collection collection;
-    collection.setRemoteId( QLatin1String( "master" ) );
-    invalidateCache( collection );
+  const QHash<QString,QByteArray> newHeads = d->currentHeads();
+  if ( newHeads != d->m_currentHeads ) {
+    if ( newHeads.keys().toSet() != d->m_currentHeads.keys().toSet() ) {
+      // A branch was created or deleted upstream
+      synchronizeCollectionTree();
+    }
+    d->m_currentHeads = newHeads;
+    // What was walked for the other branches is out of date now, they have to be
+    // walked again. A delivery in progress finishes with what it has
+    if ( !d->m_job && d->m_walkResult.delivering.isEmpty() )
+      d->m_walkResult.clear();
+    // No need to invalidate the cache, commits don't change, the sync only picks up new ones
     synchronize();
   }
 }
 
-void GitResource::handleGitFetch()
+void GitResource::fetch()
+{
+  if ( d->m_fetchJob || !d->mSettings->doGitFetch() || d->mSettings->repository().isEmpty() )
+    return;
+
+  d->m_fetchJob = new GitJob( GitJob::Fetch, QString(), this );
+  // The patterns, not the branches we have, so new upstream branches are fetched too
+  d->m_fetchJob->setBranches( d->mSettings->branches() );
+  connect( d->m_fetchJob, SIGNAL(finished()), SLOT(handleFetchFinished()) );
+  connect( d->m_fetchJob, SIGNAL(fetchProgress(int)), SLOT(handleFetchProgress(int)) );
+  d->m_watcher->blockSignals( true ); // We don't want signals during the git fetch
+  d->m_fetchWorker->enqueue( d->m_fetchJob );
+}
+
+void GitResource::handleFetchFinished()
 {
+  d->m_fetchJob->deleteLater();
+  d->m_statistics->addDuration( Statistics::Fetch, d->m_fetchJob->duration() );
+  if ( d->m_fetchJob->lastErrorCode() != GitJob::ResultSuccess )
+    kWarning() << "Fetch failed:" << d->m_fetchJob->lastErrorString();
+  d->m_fetchJob = 0;
+
   // Our own git fetch is done, re-enable so we listen to external changes
   d->m_watcher->blockSignals( false );
+  if ( !d->m_job )
+    emit status( Idle, i18n( "Ready" ) );
+
+  const QHash<QString,QByteArray> oldHeads = d->m_currentHeads;
+  handleRepositoryChanged();
+  d->m_fetchScheduler->fetchDone( d->m_currentHeads != oldHeads );
+}
+
+void GitResource::handleFetchProgress( int percent )
+{
+  emit status( Running, i18n( "Fetching from origin..." ) );
+  emit this->percent( percent );
+}
+
+void GitResource::handlePrefetchFinished()
+{
+  d->m_prefetchJob->deleteLater();
+  d->recordRender( d->m_prefetchJob );
+  const GitJob::CommitList commits = d->m_prefetchJob->commits();
+  const QList<QByteArray> bodies = d->m_prefetchJob->bodies();
+  if ( d->m_prefetchJob->lastErrorCode() != GitJob::ResultSuccess )
+    kWarning() << "Prefetch failed:" << d->m_prefetchJob->lastErrorString();
+  d->m_prefetchJob = 0;
+
+  for ( int i = 0; i < commits.count(); ++i ) {
+    const KMime::Message::Ptr message =
+      d->m_itemBuilder->item( commits, i, bodies.at( i ) ).payload<KMime::Message::Ptr>();
+    d->m_messageCache->insert( commits.sha1( i ), message->encodedContent() );
+  }
+  d->recordFlagLookups();
+
+  const QStringList pending = d->m_pendingPrefetch;
+  d->m_pendingPrefetch.clear();
+  d->prefetch( pending );
 }
 
 
@@ -27,7 +27,7 @@
 #include <Akonadi/ResourceBase>
 
 
-class GitResource : public Akonadi::ResourceBase, public Akonadi::AgentBase::Observer
+class GitResource : public Akonadi::ResourceBase, public Akonadi::AgentBase::ObserverV3
 {
   Q_OBJECT
   public:
@@ -37,18 +37,26 @@ class GitResource : public Akonadi::ResourceBase, public Akonadi::AgentBase::Obs
   public Q_SLOTS:
     /**reimp*/ void configure( WId windowId );
     void handleGetAllFinished();
-    void handleGetOneFinished();
-    void handleGetDiffFinished();
-    void handleGitFetch();
+    void handleGetMessageFinished();
+    void handleFetchProgress( int percent );
 
   protected:
     void retrieveCollections();
     void retrieveItems( const Akonadi::Collection &collection );
     bool retrieveItem( const Akonadi::Item &item, const QSet<QByteArray> &parts );
     /**reimp*/void itemChanged( const Akonadi::Item &item, const QSet<QByteArray> &parts );
+    /**reimp*/void itemsFlagsChanged( const Akonadi::Item::List &items,
+                                     const QSet<QByteArray> &addedFlags,
+                                     const QSet<QByteArray> &removedFlags );
 
   private Q_SLOTS:
     void handleRepositoryChanged();
+    void handleCommitsAvailable();
+    void deliverNextChunk();
+    void fetch();
+    void handleFetchFinished();
+    void handlePrefetchFinished();
+    void startPendingTask();
   private:
     class Private;
     Private *const d;
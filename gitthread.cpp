@@ -20,201 +20,403 @@
 #include "settings.h"
 #include "gitthread.h"
 #include "cheatingutils.h"
+#include "commitfilter.h"
+#include "commitindex.h"
+#include "diffrenderer.h"
+#include "historywalker.h"
+#include "remotefetcher.h"
 
 #include <KDE/KLocale>
 #include <KProcess>
+#include <KSaveFile>
 
 #include <QDir>
 #include <QDebug>
+#include <QBuffer>
+#include <QElapsedTimer>
 #include <QMutexLocker>
 
 #include <git2/oid.h>
+#include <git2/common.h>
 #include <git2/errors.h>
+#include <git2/threads.h>
 #include <git2/commit.h>
-#include <git2/revwalk.h>
 #include <git2/refs.h>
+#include <git2/graph.h>
 
-static GitThread::Commit parseCommit( git_commit *wcommit )
+enum {
+  ChunkSize = 500 // Commits per commitsAvailable()
+};
+
+GitThread::GitThread( GitSettings *settings, const QString &indexDirectory,
+                      QObject *parent ) : QThread( parent )
+                                        , m_repository( 0 )
+                                        , m_commitIndex( indexDirectory.isEmpty() ? 0 : new CommitIndex( indexDirectory ) )
+                                        , m_settings( settings )
+                                        , m_reloadConfiguration( true )
+                                        , m_stop( false )
+                                        , m_cancelFetch( 0 )
 {
-  Q_ASSERT( wcommit );
-  const char *cmsg = git_commit_message( wcommit );
-  const git_signature *cauth = git_commit_author( wcommit );
-  const git_time_t time = git_commit_time( wcommit );
+  git_threads_init();
+}
 
-  GitThread::Commit commit;
-  commit.author   = QLatin1String( cauth->email );
-  commit.message  = QByteArray( cmsg );
-  commit.dateTime = QDateTime::fromMSecsSinceEpoch( time * 1000 );
-  const git_oid *oid = git_commit_id( wcommit );
-  char sha1[41];
-  git_oid_fmt( sha1, oid );
-  sha1[40] = '\0';
-  commit.sha1 = QByteArray( sha1 );
-  return commit;
+GitThread::~GitThread()
+{
+  stop();
+  wait();
+  closeRepository();
+  delete m_commitIndex;
+  git_threads_shutdown();
 }
 
-GitThread::GitThread( GitSettings *settings, TaskType type, const QString &sha1,
-                      QObject *parent ) : QThread( parent )
-                                        , m_path( settings->repository() )
-                                        , m_resultCode( ResultSuccess )
-                                        , m_type( type )
-                                        , m_sha1( sha1 )
-                                        , m_settings( settings )
+void GitThread::enqueue( GitJob *job )
 {
-  m_path += QLatin1String( "/.git/" );
-  Q_ASSERT( !( type == GitThread::GetAllCommits && !sha1.isEmpty() ) );
+  Q_ASSERT( job );
+  QMutexLocker locker( &m_mutex );
+  m_stop = false;
+  m_queue.enqueue( job );
+  m_waitCondition.wakeOne();
+  locker.unlock();
+
+  if ( !isRunning() )
+    start();
 }
 
-bool GitThread::openRepository( git_repository **repository )
+void GitThread::reloadConfiguration()
 {
-  if ( git_repository_open( repository, m_path.toUtf8() ) != GIT_OK ) {
-    m_resultCode = ResultErrorOpeningRepository;
-    m_errorString = "git_repository_open error";
-    return false;
-  }
-  return true;
+  QMutexLocker locker( &m_mutex );
+  m_reloadConfiguration = true;
+}
+
+void GitThread::cancelFetch()
+{
+  m_cancelFetch = 1;
+}
+
+void GitThread::enqueueBackground( GitJob *job )
+{
+  Q_ASSERT( job );
+  QMutexLocker locker( &m_mutex );
+  m_stop = false;
+  m_backgroundQueue.enqueue( job );
+  m_waitCondition.wakeOne();
+  locker.unlock();
+
+  if ( !isRunning() )
+    start();
+}
+
+bool GitThread::hasForegroundJobs()
+{
+  QMutexLocker locker( &m_mutex );
+  return !m_queue.isEmpty() || m_stop;
+}
+
+void GitThread::stop()
+{
+  QMutexLocker locker( &m_mutex );
+  m_stop = true;
+  m_cancelFetch = 1;
+  m_queue.clear();
+  m_backgroundQueue.clear();
+  m_waitCondition.wakeAll();
 }
 
 void GitThread::run()
 {
-  kDebug() << "GitThread::run() " << m_type;
-  if ( m_type == GitThread::GetAllCommits ) {
-    getAllCommits();
-  } else if ( m_type == GitThread::GetOneCommit ) {
-    getOneCommit();
-  } else if ( m_type == GitThread::GetDiff ) {
-    if ( !CheatingUtils::gitDiff( m_path, m_sha1, &m_diff, &m_errorString ) ) {
-      m_resultCode = ResultErrorDiffing;
+  forever {
+    QMutexLocker locker( &m_mutex );
+    while ( m_queue.isEmpty() && m_backgroundQueue.isEmpty() && !m_stop )
+      m_waitCondition.wait( &m_mutex );
+
+    if ( m_stop )
+      return;
+
+    GitJob *job = m_queue.isEmpty() ? m_backgroundQueue.dequeue() : m_queue.dequeue();
+    m_cancelFetch = 0; // Only cancels the job it was meant for
+    const bool reload = m_reloadConfiguration;
+    m_reloadConfiguration = false;
+    locker.unlock();
+
+    if ( reload )
+      applyConfiguration();
+
+    kDebug() << "GitThread::run() " << job->type();
+    QElapsedTimer timer;
+    timer.start();
+    if ( job->type() == GitJob::GetAllCommits ) {
+      getAllCommits( job );
+    } else if ( job->type() == GitJob::GetMessage ) {
+      getMessage( job );
+    } else if ( job->type() == GitJob::Fetch ) {
+      fetch( job );
+    } else if ( job->type() == GitJob::FullPatch ) {
+      getFullPatch( job );
+    } else if ( job->type() == GitJob::Prefetch ) {
+      const bool done = prefetch( job );
+      job->m_duration += timer.elapsed();
+      if ( !done ) {
+        // Yielded, pick it up again once the foreground is done
+        QMutexLocker requeueLocker( &m_mutex );
+        if ( !m_stop )
+          m_backgroundQueue.prepend( job );
+        continue;
+      }
+    } else {
+      Q_ASSERT( false );
     }
-  } else {
-    Q_ASSERT( false );
+
+    if ( job->type() != GitJob::Prefetch )
+      job->m_duration = timer.elapsed();
+
+    emit job->finished();
   }
 }
 
-void GitThread::getAllCommits()
+void GitThread::applyConfiguration()
 {
-  if ( m_settings->doGitFetch() ) {
-    // First, do a git fetch
-    CheatingUtils::gitFetch( m_path, &m_errorString );
-    m_errorString.clear(); // if there's an error, lets continue, and do a normal sync without the fetch
+  // These are process wide, but there's only one resource per process
+  const int cacheMaxSize = m_settings->cacheMaxSize();
+  if ( cacheMaxSize > 0 )
+    git_libgit2_opts( GIT_OPT_SET_CACHE_MAX_SIZE, ssize_t( cacheMaxSize ) * 1024 * 1024 );
+
+  const int mwindowSize = m_settings->mWindowSize();
+  if ( mwindowSize > 0 )
+    git_libgit2_opts( GIT_OPT_SET_MWINDOW_SIZE, size_t( mwindowSize ) * 1024 * 1024 );
+
+  const int mwindowMappedLimit = m_settings->mWindowMappedLimit();
+  if ( mwindowMappedLimit > 0 )
+    git_libgit2_opts( GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, size_t( mwindowMappedLimit ) * 1024 * 1024 );
+
+  const QString path = m_settings->repository() + QLatin1String( "/.git/" );
+  if ( path != m_path ) {
+    closeRepository();
+    // Nothing to do on startup, but the oids of another repository are of no use
+    if ( !m_path.isEmpty() && m_commitIndex )
+      m_commitIndex->clear();
+    m_path = path;
   }
-  emit gitFetchDone();
+}
 
-  git_repository *repository = 0;
-  if ( !openRepository( &repository ) )
-    return;
+bool GitThread::openRepository( GitJob *job )
+{
+  if ( m_repository )
+    return true;
 
-  git_revwalk *walk_this_way;
-  if ( git_revwalk_new( &walk_this_way, repository ) != GIT_OK ) {
-    m_resultCode = ResultErrorRevwalkNew;
-    m_errorString = "git_revwalk_new error";
-    git_repository_free( repository );
-    return;
+  if ( git_repository_open( &m_repository, m_path.toUtf8() ) != GIT_OK ) {
+    m_repository = 0;
+    job->setError( GitJob::ResultErrorOpeningRepository, "git_repository_open error" );
+    return false;
   }
+  return true;
+}
 
-  git_revwalk_sorting( walk_this_way, GIT_SORT_TOPOLOGICAL | GIT_SORT_REVERSE );
-
-  //git_reference *head;
-  const QByteArray remoteHeadSha1 = CheatingUtils::getRemoteHead( m_path );
+void GitThread::closeRepository()
+{
+  git_repository_free( m_repository );
+  m_repository = 0;
+}
 
-  if ( remoteHeadSha1.isEmpty() ) {
-    m_resultCode = ResultErrorInvalidHead;
-    m_errorString = "Can't find head for origin/master";
-    git_repository_free( repository );
-    return;
-  }
-  /*
-  if ( git_repository_head( &head, repository ) != GIT_OK ) {
-    m_resultCode = ResultErrorRepositoryHead;
-    m_errorString = "git_repository_head error";
-    git_repository_free( repository );
-    return;
-  }
-  const git_oid *head_oid = git_reference_oid( head );
-  */
-
-  git_oid head_oid;
-  if ( git_oid_fromstr( &head_oid, remoteHeadSha1.data() ) != GIT_OK ) {
-    m_resultCode = ResultErrorInvalidHead;
-    m_errorString = "Can't find head for origin/master";
-    git_repository_free( repository );
+void GitThread::getAllCommits( GitJob *job )
+{
+  if ( !openRepository( job ) )
     return;
+
+  const git_time_t cutoff = QDateTime( m_settings->from().date() ).toMSecsSinceEpoch() / 1000;
+  const CommitFilter filter( m_settings );
+  HistoryWalker walker( m_repository, filter, cutoff, m_commitIndex );
+
+  // All branches are walked together, so history they share is only walked once
+  const QStringList branches = job->branches();
+  for ( int i = 0; i < branches.count(); ++i ) {
+    const QString &branch = branches.at( i );
+    const QByteArray headSha1 = CheatingUtils::getRemoteHead( m_path, branch );
+    git_oid head_oid;
+    if ( headSha1.isEmpty() || git_oid_fromstr( &head_oid, headSha1.constData() ) != GIT_OK ||
+         !walker.addHead( head_oid, i ) ) {
+      kWarning() << "Can't find head for origin/" << branch << walker.errorString();
+      continue;
+    }
+    job->m_heads.insert( branch, headSha1 );
+
+    // Only report what's new since the last sync. If the old head is gone ( gc after a
+    // force push, for example ) we fall back to a full walk for that branch. So we do
+    // if it's still there but was rewritten away, or its commits would stay listed.
+    const QByteArray oldSha1 = job->m_lastSyncedHeads.value( branch );
+    git_oid old_oid;
+    size_t ahead = 0, behind = 0;
+    if ( !oldSha1.isEmpty() && git_oid_fromstr( &old_oid, oldSha1.constData() ) == GIT_OK &&
+         git_graph_ahead_behind( &ahead, &behind, m_repository, &head_oid, &old_oid ) == GIT_OK &&
+         behind == 0 && walker.addKnownHead( old_oid, i ) ) {
+      job->m_incrementalBranches.insert( branch );
+    } else if ( !oldSha1.isEmpty() ) {
+      kDebug() << "Last synced head not found or not an ancestor, doing a full walk" << branch << oldSha1;
+    }
   }
 
-  int error = 0;
-  if ( ( error = git_revwalk_push( walk_this_way, &head_oid ) ) != GIT_OK ) {
-    m_resultCode = ResultErrorRevwalkPush;
-    m_errorString = "git_revwalk_push error: " + QString::number( error );
-    git_repository_free( repository );
+  if ( job->m_heads.isEmpty() ) {
+    job->setError( GitJob::ResultErrorInvalidHead, "Can't find head for any of " + branches.join( ", " ) );
     return;
   }
 
-  while( ( git_revwalk_next( &head_oid, walk_this_way ) ) == GIT_OK ) {
-    git_commit *wcommit = 0;
-    if ( git_commit_lookup( &wcommit, repository, &head_oid ) != GIT_OK ) {
-      m_resultCode = ResultErrorCommitLookup;
-      m_errorString = "git_commit_lookup error";
-      git_repository_free( repository );
+  // Hand out commits as they're found, so the resource doesn't wait for the whole walk
+  GitJob::CommitList chunk;
+  while ( !walker.atEnd() ) {
+    chunk.clear();
+    if ( !walker.walk( &chunk, ChunkSize ) ) {
+      job->setError( GitJob::ResultErrorCommitLookup, walker.errorString() );
       return;
     }
-
-    m_commits << parseCommit( wcommit );
-    git_commit_free( wcommit );
+    if ( !chunk.isEmpty() ) {
+      job->appendCommits( chunk );
+      emit job->commitsAvailable();
+    }
   }
-
-  git_revwalk_free( walk_this_way );
-  git_repository_free( repository );
 }
 
-void GitThread::getOneCommit()
+void GitThread::getMessage( GitJob *job )
 {
-  if ( m_sha1.isEmpty() ) {
-    m_resultCode = ResultNothingToFetch;
-    m_errorString = i18n( "Error: Empty remote id" );
+  if ( job->sha1().isEmpty() ) {
+    job->setError( GitJob::ResultNothingToFetch, i18n( "Error: Empty remote id" ) );
     return;
   }
 
-  git_repository *repository = 0;
-  if ( !openRepository( &repository ) )
+  if ( !openRepository( job ) )
     return;
 
   git_commit *wcommit = 0;
   git_oid oid;
-  git_oid_fromstr( &oid, m_sha1.toUtf8().data() );
-  if ( git_commit_lookup( &wcommit, repository, &oid ) != GIT_OK ) {
-    m_resultCode = ResultErrorCommitLookup;
-    m_errorString = "git_commit_lookup error";
-    git_repository_free( repository );
+  if ( git_oid_fromstr( &oid, job->sha1().toLatin1().data() ) != GIT_OK ||
+       git_commit_lookup( &wcommit, m_repository, &oid ) != GIT_OK ) {
+    job->setError( GitJob::ResultErrorCommitLookup, "git_commit_lookup error" );
     return;
   }
 
-  m_commits << parseCommit( wcommit );
+  const git_time_t cutoff = QDateTime( m_settings->from().date() ).toMSecsSinceEpoch() / 1000;
+  const CommitFilter filter( m_settings );
+  DiffRenderer renderer( m_repository );
+  setupRenderer( &renderer );
+
+  // Only the requested commit is rendered here, someone is waiting for it
+  if ( !render( job, &renderer, wcommit ) ) {
+    job->setError( GitJob::ResultErrorDiffing, i18n( "Error obtaining diff: %1", renderer.errorString() ) );
+    git_commit_free( wcommit );
+    return;
+  }
+
+  // Its first parent ancestors are what a client listing or indexing the folder asks
+  // for next. They're only looked up, and rendered by a Prefetch job
+  for ( int i = 0; i < job->m_readAhead; ++i ) {
+    git_commit *parent = 0;
+    if ( git_commit_parentcount( wcommit ) == 0 || git_commit_parent( &parent, wcommit, 0 ) != GIT_OK )
+      break;
+    git_commit_free( wcommit );
+    wcommit = parent;
+    if ( git_commit_time( wcommit ) < cutoff )
+      break;
+    if ( filter.accepts( wcommit ) ) {
+      char sha1[GIT_OID_HEXSZ + 1];
+      git_oid_tostr( sha1, sizeof( sha1 ), git_commit_id( wcommit ) );
+      job->m_sha1List << QString::fromLatin1( sha1 );
+    }
+  }
 
   git_commit_free( wcommit );
-  git_repository_free( repository );
 }
 
+void GitThread::setupRenderer( DiffRenderer *renderer ) const
+{
+  renderer->setLimits( qint64( m_settings->diffBudget() ) * 1024, qint64( m_settings->fileDiffBudget() ) * 1024 );
+  renderer->setGeneratedFilePatterns( m_settings->generatedFilePatterns() );
+}
 
-QString GitThread::lastErrorString() const
+bool GitThread::render( GitJob *job, DiffRenderer *renderer, git_commit *commit )
 {
-  QMutexLocker locker( &m_mutex );
-  return m_errorString;
+  // Render straight into the buffer that becomes the message body
+  QByteArray body;
+  QBuffer buffer( &body );
+  buffer.open( QIODevice::WriteOnly );
+  if ( !renderer->render( commit, &buffer ) )
+    return false;
+
+  if ( renderer->isTruncated() ) {
+    char sha1[GIT_OID_HEXSZ + 1];
+    git_oid_tostr( sha1, sizeof( sha1 ), git_commit_id( commit ) );
+    buffer.write( '\n' + i18n( "The full patch is written to a file by the resource's /Patches D-Bus object,\n"
+                                "call fullPatch( \"%1\" ) on it for its path.\n",
+                                QLatin1String( sha1 ) ).toUtf8() );
+  }
+
+  job->m_commits.add( commit );
+  job->m_bodies << body;
+  job->m_renderedBytes += body.size();
+  return true;
 }
 
-GitThread::ResultCode GitThread::lastErrorCode() const
+bool GitThread::prefetch( GitJob *job )
 {
-  QMutexLocker locker( &m_mutex );
-  return m_resultCode;
+  if ( !openRepository( job ) )
+    return true;
+
+  DiffRenderer renderer( m_repository );
+  setupRenderer( &renderer );
+
+  const QStringList sha1List = job->sha1List();
+  while ( job->m_position < sha1List.count() &&
+          ( job->m_maxBytes <= 0 || job->m_renderedBytes < job->m_maxBytes ) ) {
+    if ( hasForegroundJobs() )
+      return false;
+
+    git_commit *commit = 0;
+    git_oid oid;
+    const QByteArray sha1 = sha1List.at( job->m_position++ ).toLatin1();
+    if ( git_oid_fromstr( &oid, sha1.constData() ) != GIT_OK ||
+         git_commit_lookup( &commit, m_repository, &oid ) != GIT_OK )
+      continue; // Gone with a repository change, nothing to prefetch
+
+    if ( !render( job, &renderer, commit ) )
+      kDebug() << "Prefetching" << sha1 << "failed:" << renderer.errorString();
+    git_commit_free( commit );
+  }
+  return true;
 }
 
-QVector<GitThread::Commit> GitThread::commits() const
+void GitThread::fetch( GitJob *job )
 {
-  QMutexLocker locker( &m_mutex );
-  return m_commits;
+  if ( !openRepository( job ) )
+    return;
+
+  RemoteFetcher fetcher( m_repository, m_path, &m_cancelFetch );
+  fetcher.setFreshness( m_settings->fetchFreshness() );
+  connect( &fetcher, SIGNAL(progress(int)), job, SIGNAL(fetchProgress(int)), Qt::DirectConnection );
+  if ( !fetcher.fetch( job->branches() ) )
+    job->setError( GitJob::ResultErrorPulling, fetcher.errorString() );
 }
 
-QByteArray GitThread::diff() const
+void GitThread::getFullPatch( GitJob *job )
 {
-  QMutexLocker locker( &m_mutex );
-  return m_diff;
+  if ( !openRepository( job ) )
+    return;
+
+  git_commit *commit = 0;
+  git_oid oid;
+  if ( git_oid_fromstr( &oid, job->sha1().toLatin1().data() ) != GIT_OK ||
+       git_commit_lookup( &commit, m_repository, &oid ) != GIT_OK ) {
+    job->setError( GitJob::ResultErrorCommitLookup, "git_commit_lookup error" );
+    return;
+  }
+
+  // No limits, this is what the truncation markers point to
+  DiffRenderer renderer( m_repository );
+  KSaveFile file( job->fileName() );
+  if ( !file.open( QIODevice::WriteOnly ) ) {
+    job->setError( GitJob::ResultErrorDiffing, file.errorString() );
+  } else if ( !renderer.render( commit, &file ) ) {
+    file.abort();
+    job->setError( GitJob::ResultErrorDiffing, i18n( "Error obtaining diff: %1", renderer.errorString() ) );
+  } else if ( !file.finalize() ) {
+    job->setError( GitJob::ResultErrorDiffing, file.errorString() );
+  }
+
+  git_commit_free( commit );
 }
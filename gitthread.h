@@ -20,73 +20,96 @@
 #ifndef AKONADI_GIT_THREAD_H_
 #define AKONADI_GIT_THREAD_H_
 
+#include "gitjob.h"
+
+#include <QAtomicInt>
 #include <QMutex>
+#include <QQueue>
 #include <QThread>
 #include <QString>
-#include <QVector>
-#include <QDateTime>
+#include <QWaitCondition>
 
 #include <git2/repository.h>
 
+class CommitIndex;
+class DiffRenderer;
 class GitSettings;
+
+/**
+ * Long lived worker that executes GitJobs one after the other.
+ *
+ * The repository is opened on the first job and kept open, so pack indexes stay
+ * mapped and libgit2's object cache stays warm between jobs. It's only reopened
+ * after reloadConfiguration() if the repository path changed.
+ *
+ * Commit metadata is kept in a CommitIndex under @p indexDirectory, so listings
+ * after a restart don't have to go through libgit2 again. Without a directory
+ * there's no index, which suits a worker that only fetches.
+ */
 class GitThread : public QThread {
   Q_OBJECT
 public:
+  GitThread( GitSettings *settings, const QString &indexDirectory, QObject *parent = 0 );
+  ~GitThread();
 
-  enum TaskType {
-    GetAllCommits,
-    GetOneCommit,
-    GetDiff
-  };
-
-  enum ResultCode {
-    ResultSuccess,
-    ResultErrorOpeningRepository,
-    ResultErrorCommitLookup,
-    ResultErrorRevwalkPush,
-    ResultErrorRevwalkNew,
-    ResultErrorRepositoryHead,
-    ResultNothingToFetch,
-    ResultErrorDiffing,
-    ResultErrorInvalidHead,
-    ResultErrorPulling,
-  };
-
-  struct Commit {
-    QString author;
-    QByteArray message;
-    QDateTime dateTime;
-    QString sha1;
-  };
-
-  GitThread( GitSettings *settings,
-             TaskType type,
-             const QString &sha1 = QString(),
-             QObject *parent = 0 );
-  void run();
+  /**
+   * Queues @p job. The thread is started if it isn't running yet.
+   */
+  void enqueue( GitJob *job );
+
+  /**
+   * Queues @p job behind everything enqueue()d, for work nobody is waiting on.
+   * A Prefetch job gives way, between commits, to jobs enqueue()d while it runs,
+   * and carries on after them.
+   */
+  void enqueueBackground( GitJob *job );
+
+  /**
+   * Re-reads the repository path and libgit2 cache settings before the next job.
+   */
+  void reloadConfiguration();
+
+  /**
+   * Aborts the fetch the current job is doing, if any. The job carries on without it.
+   */
+  void cancelFetch();
 
-  QString lastErrorString() const;
-  ResultCode lastErrorCode() const;
-  QVector<Commit> commits() const;
-  QByteArray diff() const;
-Q_SIGNALS:
-  void gitFetchDone();
+  /**
+   * Cancels the fetch, finishes the current job, drops the pending ones and stops the thread.
+   */
+  void stop();
+
+protected:
+  void run();
 
 private:
-  bool openRepository( git_repository ** );
-  void getAllCommits();
-  void getOneCommit();
+  void applyConfiguration();
+  bool openRepository( GitJob *job );
+  void closeRepository();
+
+  void getAllCommits( GitJob *job );
+  void getMessage( GitJob *job );
+  void fetch( GitJob *job );
+  void getFullPatch( GitJob *job );
+  bool prefetch( GitJob *job );
+
+  void setupRenderer( DiffRenderer *renderer ) const;
+  bool render( GitJob *job, DiffRenderer *renderer, git_commit *commit );
+  bool hasForegroundJobs();
 
 private:
-  QVector<Commit> m_commits;
-  QByteArray m_diff;
+  git_repository *m_repository;
+  CommitIndex *m_commitIndex;
   QString m_path;
-  QString m_errorString;
-  ResultCode m_resultCode;
-  TaskType m_type;
-  QString m_sha1;
   GitSettings *m_settings;
-  mutable QMutex m_mutex;
+
+  QQueue<GitJob*> m_queue;
+  QQueue<GitJob*> m_backgroundQueue;
+  bool m_reloadConfiguration;
+  bool m_stop;
+  QAtomicInt m_cancelFetch;
+  QMutex m_mutex;
+  QWaitCondition m_waitCondition;
 };
 
 #endif
@@ -0,0 +1,240 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "historywalker.h"
+#include "commitfilter.h"
+#include "commitindex.h"
+
+#include <KDebug>
+
+#include <git2/commit.h>
+#include <git2/errors.h>
+
+#include <algorithm>
+
+static QString lastGitError( const char *what )
+{
+  const git_error *error = giterr_last();
+  return QString::fromLatin1( what ) + QLatin1String( ": " ) +
+         ( error ? QString::fromUtf8( error->message ) : QLatin1String( "unknown error" ) );
+}
+
+HistoryWalker::HistoryWalker( git_repository *repository, const CommitFilter &filter,
+                              git_time_t cutoff, CommitIndex *commitIndex ) : m_repository( repository )
+                                                                            , m_filter( filter )
+                                                                            , m_cutoff( cutoff )
+                                                                            , m_commitIndex( commitIndex )
+                                                                            , m_interestingCount( 0 )
+{
+}
+
+bool HistoryWalker::commitTime( const git_oid &oid, git_time_t *time )
+{
+  const int record = m_commitIndex ? m_commitIndex->find( oid ) : -1;
+  if ( record != -1 ) {
+    *time = m_commitIndex->record( record ).time;
+    return true;
+  }
+
+  git_commit *commit = 0;
+  if ( git_commit_lookup( &commit, m_repository, &oid ) != GIT_OK ) {
+    m_errorString = lastGitError( "git_commit_lookup" );
+    return false;
+  }
+  *time = git_commit_time( commit );
+  git_commit_free( commit );
+  return true;
+}
+
+bool HistoryWalker::addHead( const git_oid &oid, int branch )
+{
+  Q_ASSERT( branch >= 0 && branch < 32 );
+  git_time_t time;
+  if ( !commitTime( oid, &time ) )
+    return false;
+
+  mark( node( oid, time ), quint32( 1 ) << branch, 0 );
+  return true;
+}
+
+bool HistoryWalker::addKnownHead( const git_oid &oid, int branch )
+{
+  Q_ASSERT( branch >= 0 && branch < 32 );
+  git_time_t time;
+  if ( !commitTime( oid, &time ) )
+    return false;
+
+  mark( node( oid, time ), 0, quint32( 1 ) << branch );
+  return true;
+}
+
+int HistoryWalker::node( const git_oid &oid, git_time_t time )
+{
+  QHash<git_oid,int>::const_iterator it = m_index.constFind( oid );
+  if ( it != m_index.constEnd() )
+    return it.value();
+
+  Node node;
+  node.oid = oid;
+  node.time = time;
+  node.wanted = 0;
+  node.known = 0;
+  node.passedWanted = 0;
+  node.passedKnown = 0;
+  node.reported = 0;
+  node.filtered = NotFiltered;
+  node.queued = false;
+  m_nodes << node;
+  m_index.insert( oid, m_nodes.count() - 1 );
+  return m_nodes.count() - 1;
+}
+
+bool HistoryWalker::isInteresting( const Node &node ) const
+{
+  // Something new for some branch, and inside the date window
+  return ( node.wanted & ~node.known ) && node.time >= m_cutoff;
+}
+
+void HistoryWalker::mark( int index, quint32 wanted, quint32 known )
+{
+  Node &node = m_nodes[index];
+  if ( !( wanted & ~node.wanted ) && !( known & ~node.known ) )
+    return;
+
+  if ( node.queued && isInteresting( node ) )
+    --m_interestingCount;
+
+  node.wanted |= wanted;
+  node.known |= known;
+
+  if ( !node.queued ) {
+    node.queued = true;
+    m_queue.append( qMakePair( node.time, index ) );
+    std::push_heap( m_queue.begin(), m_queue.end() );
+  }
+
+  if ( isInteresting( node ) )
+    ++m_interestingCount;
+}
+
+bool HistoryWalker::atEnd() const
+{
+  // Once no queued commit is interesting, nothing below them can be either
+  return m_queue.isEmpty() || m_interestingCount == 0;
+}
+
+bool HistoryWalker::walk( GitJob::CommitList *commits, int limit )
+{
+  Q_ASSERT( commits );
+  const int end = limit == -1 ? -1 : commits->count() + limit;
+  while ( !atEnd() && commits->count() != end ) {
+    std::pop_heap( m_queue.begin(), m_queue.end() );
+    const int index = m_queue.last().second;
+    m_queue.pop_back();
+
+    // Careful, node() appends to m_nodes, don't use this reference after calling it
+    Node &node = m_nodes[index];
+    if ( isInteresting( node ) )
+      --m_interestingCount;
+    node.queued = false;
+
+    // Interest doesn't go past the cutoff, what's known always goes down
+    const quint32 wanted = node.time >= m_cutoff ? node.wanted : 0;
+    const quint32 toReport = wanted & ~node.known & ~node.reported;
+    const quint32 newWanted = wanted & ~node.passedWanted;
+    const quint32 newKnown = node.known & ~node.passedKnown;
+    if ( !toReport && !newWanted && !newKnown )
+      continue;
+
+    const int record = m_commitIndex ? m_commitIndex->find( node.oid ) : -1;
+    if ( record != -1 && m_commitIndex->hasAllParents( record ) ) {
+      visitIndexed( index, record, toReport, newWanted, newKnown, commits );
+      continue;
+    }
+
+    git_commit *commit = 0;
+    if ( git_commit_lookup( &commit, m_repository, &node.oid ) != GIT_OK ) {
+      m_errorString = lastGitError( "git_commit_lookup" );
+      return false;
+    }
+
+    if ( toReport ) {
+      node.reported |= toReport;
+      if ( node.filtered == NotFiltered )
+        node.filtered = m_filter.accepts( commit ) ? Accepted : Rejected;
+      if ( node.filtered == Accepted )
+        commits->add( commit, toReport );
+    }
+
+    node.passedWanted |= newWanted;
+    node.passedKnown |= newKnown;
+
+    const unsigned int parentCount = git_commit_parentcount( commit );
+    for ( unsigned int i = 0; i < parentCount && ( newWanted || newKnown ); ++i ) {
+      git_commit *parent = 0;
+      if ( git_commit_parent( &parent, commit, i ) != GIT_OK ) {
+        // Shallow clone, probably
+        kDebug() << "Can't find parent" << i << "of" << GitOid::toString( *git_commit_id( commit ) );
+        continue;
+      }
+      const int parentIndex = this->node( *git_commit_id( parent ), git_commit_time( parent ) );
+      git_commit_free( parent );
+      mark( parentIndex, newWanted, newKnown );
+    }
+
+    if ( m_commitIndex )
+      m_commitIndex->add( commit );
+    git_commit_free( commit );
+  }
+
+  if ( m_commitIndex && atEnd() )
+    m_commitIndex->flush();
+  return true;
+}
+
+void HistoryWalker::visitIndexed( int index, int record, quint32 toReport, quint32 newWanted,
+                                  quint32 newKnown, GitJob::CommitList *commits )
+{
+  const CommitIndex::Record &r = m_commitIndex->record( record );
+  Node &node = m_nodes[index];
+
+  if ( toReport ) {
+    node.reported |= toReport;
+    const QByteArray email = m_commitIndex->author( record );
+    const QByteArray subject = m_commitIndex->subject( record );
+    if ( node.filtered == NotFiltered )
+      node.filtered = m_filter.accepts( email.constData(), subject.constData(), subject.size() ) ? Accepted : Rejected;
+    if ( node.filtered == Accepted )
+      commits->add( r.oid, r.time, email, subject.constData(), subject.size(), toReport );
+  }
+
+  node.passedWanted |= newWanted;
+  node.passedKnown |= newKnown;
+
+  // node() appends to m_nodes, so node isn't used past this point
+  for ( quint32 i = 0; i < r.parentCount && ( newWanted || newKnown ); ++i ) {
+    const CommitIndex::Record &parent = m_commitIndex->record( m_commitIndex->parent( record, i ) );
+    mark( this->node( parent.oid, parent.time ), newWanted, newKnown );
+  }
+}
+
+QString HistoryWalker::errorString() const
+{
+  return m_errorString;
+}
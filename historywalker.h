@@ -0,0 +1,110 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef HISTORY_WALKER_H_
+#define HISTORY_WALKER_H_
+
+#include "gitjob.h"
+#include "gitoid.h"
+
+#include <QHash>
+#include <QPair>
+#include <QVector>
+#include <QString>
+
+#include <git2/types.h>
+
+class CommitFilter;
+class CommitIndex;
+
+/**
+ * Walks the history of several branches at once, newest commits first.
+ *
+ * Every commit is looked up and parsed once, no matter how many branches reach it,
+ * and is reported with a mask of the branches it belongs to. Commits reachable from
+ * a branch's last synced head aren't reported for that branch again, and nothing
+ * older than the cutoff is reported. The walk stops as soon as nothing left in the
+ * queue can produce new commits.
+ *
+ * With a CommitIndex, commits that are in it are walked without libgit2, and the
+ * ones that aren't are added to it.
+ */
+class HistoryWalker {
+public:
+  HistoryWalker( git_repository *repository, const CommitFilter &filter, git_time_t cutoff,
+                 CommitIndex *commitIndex = 0 );
+
+  /**
+   * @p branch is the bit used in GitJob::Commit::branches, at most 31.
+   */
+  bool addHead( const git_oid &oid, int branch );
+  bool addKnownHead( const git_oid &oid, int branch );
+
+  /**
+   * Walks and appends the commits that are new to at least one branch, newest first,
+   * stopping once @p limit commits were appended, if it isn't -1. Call again to resume
+   * until atEnd().
+   *
+   * A commit found to be new to more branches after it was appended is appended
+   * again, with only those branches set.
+   */
+  bool walk( GitJob::CommitList *commits, int limit = -1 );
+  bool atEnd() const;
+
+  QString errorString() const;
+
+private:
+  enum Filtered {
+    NotFiltered,
+    Accepted,
+    Rejected
+  };
+
+  struct Node {
+    git_oid oid;
+    git_time_t time;
+    quint32 wanted;           // branches whose new head reaches this commit
+    quint32 known;            // branches whose last synced head reaches this commit
+    quint32 passedWanted;     // what was already propagated to the parents
+    quint32 passedKnown;
+    quint32 reported;         // branches this commit was already reported for
+    char filtered;            // a Filtered value
+    bool queued;
+  };
+
+  int node( const git_oid &oid, git_time_t time );
+  bool commitTime( const git_oid &oid, git_time_t *time );
+  void visitIndexed( int index, int record, quint32 toReport, quint32 newWanted,
+                     quint32 newKnown, GitJob::CommitList *commits );
+  bool isInteresting( const Node &node ) const;
+  void mark( int index, quint32 wanted, quint32 known );
+
+  git_repository *m_repository;
+  const CommitFilter &m_filter;
+  const git_time_t m_cutoff;
+  CommitIndex *m_commitIndex;
+
+  QVector<Node> m_nodes;
+  QHash<git_oid,int> m_index;
+  QVector<QPair<git_time_t,int> > m_queue; // binary max-heap, by commit time
+  int m_interestingCount;                  // interesting nodes in the queue
+  QString m_errorString;
+};
+
+#endif
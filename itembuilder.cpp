@@ -0,0 +1,114 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "itembuilder.h"
+#include "flagdatabase.h"
+
+#include <KMime/Message>
+#include <KDateTime>
+
+#include <QElapsedTimer>
+
+static QByteArray messageId( const QString &sha1 )
+{
+  return '<' + sha1.toLatin1() + "@git>";
+}
+
+ItemBuilder::ItemBuilder( FlagDatabase *flagsDatabase ) : m_flagsDatabase( flagsDatabase )
+                                                        , m_flagLookupTime( 0 )
+{
+  Q_ASSERT( flagsDatabase );
+}
+
+void ItemBuilder::setIdentity( const QString &identity )
+{
+  m_identity = identity;
+}
+
+Akonadi::Item ItemBuilder::item( const GitJob::CommitList &commits, int index,
+                                 const QByteArray &body ) const
+{
+  Akonadi::Item item;
+  item.setMimeType( KMime::Message::mimeType() );
+  const QString sha1 = commits.sha1( index );
+
+  KMime::Message *message = new KMime::Message();
+  KMime::Headers::ContentType *ct = message->contentType();
+  ct->setMimeType( "text/plain" );
+  message->contentTransferEncoding()->clear();
+
+  message->subject()->fromUnicodeString( commits.subject( index ), "utf-8" );
+  message->from()->fromUnicodeString( commits.author( index ), "utf-8" );
+  message->to()->fromUnicodeString( m_identity, "utf-8" );
+  // message->cc()->fromUnicodeString( "some@mailaddy.com", "utf-8" ); // parse CCMAIL:
+  message->date()->setDateTime( KDateTime( commits.dateTime( index ) ) );
+  message->messageID()->from7BitString( messageId( sha1 ) );
+  item.setPayload( KMime::Message::Ptr( message ) );
+
+  message->contentType()->setMimeType( "text/plain" );
+  message->contentType()->setCharset( "UTF-8" );
+
+  if ( !body.isEmpty() ) {
+    message->setBody( body );
+  }
+
+  item.setRemoteId( sha1 );
+  message->assemble();
+
+  QElapsedTimer timer;
+  timer.start();
+  item.setFlags( m_flagsDatabase->flags( commits.at( index ).oid ) );
+  m_flagLookupTime += timer.nsecsElapsed();
+  return item;
+}
+
+Akonadi::Item ItemBuilder::envelope( const GitJob::CommitList &commits, int index ) const
+{
+  Akonadi::Item item;
+  item.setMimeType( KMime::Message::mimeType() );
+  const QString sha1 = commits.sha1( index );
+  item.setRemoteId( sha1 );
+  QElapsedTimer timer;
+  timer.start();
+  item.setFlags( m_flagsDatabase->flags( commits.at( index ).oid ) );
+  m_flagLookupTime += timer.nsecsElapsed();
+
+  // Only the headers the ENVELOPE part is made of, and no assemble(). HEAD is
+  // stored from head(), which only assemble() fills in, so it's built right here.
+  KMime::Message *message = new KMime::Message();
+  message->subject()->fromUnicodeString( commits.subject( index ), "utf-8" );
+  message->from()->fromUnicodeString( commits.author( index ), "utf-8" );
+  message->date()->setDateTime( KDateTime( commits.dateTime( index ) ) );
+  message->messageID()->from7BitString( messageId( sha1 ) );
+  message->setHead( message->subject()->as7BitString() + '\n' +
+                    message->from()->as7BitString() + '\n' +
+                    message->date()->as7BitString() + '\n' +
+                    message->messageID()->as7BitString() + '\n' );
+
+  item.setPayload( KMime::Message::Ptr( message ) );
+  return item;
+}
+
+qint64 ItemBuilder::takeFlagLookupTime()
+{
+  const qint64 time = m_flagLookupTime;
+  m_flagLookupTime = 0;
+  return time;
+}
@@ -0,0 +1,66 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#ifndef ITEM_BUILDER_H_
+#define ITEM_BUILDER_H_
+
+#include "gitjob.h"
+
+#include <Akonadi/Item>
+
+#include <QString>
+
+class FlagDatabase;
+
+/**
+ * Turns walked commits into mail items, flags included.
+ */
+class ItemBuilder {
+public:
+  explicit ItemBuilder( FlagDatabase *flagsDatabase );
+
+  /**
+   * Who the messages are addressed to.
+   */
+  void setIdentity( const QString &identity );
+
+  /**
+   * The full message, with @p body as rendered by the worker.
+   */
+  Akonadi::Item item( const GitJob::CommitList &commits, int index,
+                      const QByteArray &body = QByteArray() ) const;
+
+  /**
+   * What listing needs, without the cost of a full message. See item() for that.
+   */
+  Akonadi::Item envelope( const GitJob::CommitList &commits, int index ) const;
+
+  /**
+   * Time spent looking up flags since the last call, in ns.
+   */
+  qint64 takeFlagLookupTime();
+
+private:
+  FlagDatabase *m_flagsDatabase;
+  QString m_identity;
+  mutable qint64 m_flagLookupTime;
+};
+
+#endif
@@ -0,0 +1,208 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "messagecache.h"
+
+#include <KStandardDirs>
+#include <KSaveFile>
+#include <KDebug>
+
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QPair>
+#include <QVector>
+#include <QCache>
+#include <QDateTime>
+#include <QFileInfo>
+
+#include <algorithm>
+
+#include <sys/types.h>
+#include <utime.h>
+
+enum {
+  MemoryCacheSize = 16 * 1024 * 1024 // bytes
+};
+
+struct CacheEntry {
+  qint64 size;
+  uint lastUsed;
+};
+
+typedef QPair<uint, QString> UsageEntry;
+
+class MessageCache::Private
+{
+public:
+  Private( const QString &identifier, qint64 maxSize ) : m_maxSize( maxSize )
+                                                       , m_totalSize( 0 )
+  {
+    m_directory = KStandardDirs::locateLocal( "data", identifier + QLatin1String( "/messages/" ) );
+    m_memoryCache.setMaxCost( MemoryCacheSize );
+    loadIndex();
+  }
+
+  void loadIndex();
+  void evict();
+  void remove( const QString &sha1 );
+  QString fileName( const QString &sha1 ) const;
+
+  QString m_directory;
+  qint64 m_maxSize;
+  qint64 m_totalSize;
+  QHash<QString, CacheEntry> m_entries;
+  QCache<QString, QByteArray> m_memoryCache;
+};
+
+void MessageCache::Private::loadIndex()
+{
+  // The file's modification time is its last use, so the LRU order survives restarts
+  const QFileInfoList files = QDir( m_directory ).entryInfoList( QDir::Files );
+  foreach( const QFileInfo &info, files ) {
+    if ( info.fileName().length() != 40 ) // leftovers from KSaveFile
+      continue;
+    CacheEntry entry;
+    entry.size = info.size();
+    entry.lastUsed = info.lastModified().toTime_t();
+    m_entries.insert( info.fileName(), entry );
+    m_totalSize += entry.size;
+  }
+  evict();
+}
+
+void MessageCache::Private::evict()
+{
+  if ( m_totalSize <= m_maxSize )
+    return;
+
+  // Go a bit below the budget, so we don't have to do this on every insert
+  const qint64 target = m_maxSize - m_maxSize / 10;
+
+  QVector<UsageEntry> usage;
+  usage.reserve( m_entries.count() );
+  QHash<QString, CacheEntry>::const_iterator it = m_entries.constBegin();
+  for ( ; it != m_entries.constEnd(); ++it )
+    usage << qMakePair( it.value().lastUsed, it.key() );
+  std::sort( usage.begin(), usage.end() );
+
+  foreach( const UsageEntry &entry, usage ) {
+    if ( m_totalSize <= target )
+      break;
+    remove( entry.second );
+  }
+}
+
+void MessageCache::Private::remove( const QString &sha1 )
+{
+  m_totalSize -= m_entries.take( sha1 ).size;
+  m_memoryCache.remove( sha1 );
+  QFile::remove( fileName( sha1 ) );
+}
+
+QString MessageCache::Private::fileName( const QString &sha1 ) const
+{
+  return m_directory + sha1;
+}
+
+MessageCache::MessageCache( const QString &identifier, qint64 maxSize )
+  : d( new Private( identifier, maxSize ) )
+{
+}
+
+MessageCache::~MessageCache()
+{
+  delete d;
+}
+
+void MessageCache::setMaxSize( qint64 maxSize )
+{
+  d->m_maxSize = maxSize;
+  d->evict();
+}
+
+QByteArray MessageCache::message( const QString &sha1 )
+{
+  if ( !d->m_entries.contains( sha1 ) ) {
+    if ( QByteArray *data = d->m_memoryCache.object( sha1 ) )
+      return *data;
+    return QByteArray();
+  }
+
+  const QString fileName = d->fileName( sha1 );
+  d->m_entries[sha1].lastUsed = QDateTime::currentDateTime().toTime_t();
+  utime( QFile::encodeName( fileName ).constData(), 0 );
+
+  if ( QByteArray *data = d->m_memoryCache.object( sha1 ) )
+    return *data;
+
+  QFile file( fileName );
+  if ( !file.open( QIODevice::ReadOnly ) ) {
+    kWarning() << "Error reading cached message" << fileName << file.errorString();
+    d->remove( sha1 );
+    return QByteArray();
+  }
+
+  const QByteArray data = qUncompress( file.readAll() );
+  if ( data.isEmpty() ) {
+    kWarning() << "Removing corrupt cached message" << fileName;
+    d->remove( sha1 );
+  } else {
+    d->m_memoryCache.insert( sha1, new QByteArray( data ), data.size() );
+  }
+  return data;
+}
+
+bool MessageCache::contains( const QString &sha1 ) const
+{
+  return d->m_entries.contains( sha1 ) || d->m_memoryCache.contains( sha1 );
+}
+
+void MessageCache::insert( const QString &sha1, const QByteArray &encodedMessage )
+{
+  Q_ASSERT( sha1.length() == 40 );
+  d->m_memoryCache.insert( sha1, new QByteArray( encodedMessage ), encodedMessage.size() );
+
+  if ( d->m_maxSize <= 0 || d->m_entries.contains( sha1 ) )
+    return;
+
+  const QByteArray compressed = qCompress( encodedMessage );
+  KSaveFile file( d->fileName( sha1 ) );
+  if ( !file.open() || file.write( compressed ) != compressed.size() || !file.finalize() ) {
+    kWarning() << "Error caching message" << sha1 << file.errorString();
+    file.abort();
+    return;
+  }
+
+  CacheEntry entry;
+  entry.size = compressed.size();
+  entry.lastUsed = QDateTime::currentDateTime().toTime_t();
+  d->m_entries.insert( sha1, entry );
+  d->m_totalSize += entry.size;
+  d->evict();
+}
+
+void MessageCache::clear()
+{
+  foreach( const QString &sha1, d->m_entries.keys() )
+    QFile::remove( d->fileName( sha1 ) );
+  d->m_entries.clear();
+  d->m_memoryCache.clear();
+  d->m_totalSize = 0;
+}
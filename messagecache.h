@@ -0,0 +1,60 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef MESSAGE_CACHE_H_
+#define MESSAGE_CACHE_H_
+
+#include <QString>
+#include <QByteArray>
+
+/**
+ * Assembled messages, keyed by commit sha1.
+ *
+ * A commit never changes, so once rendered its message can be reused. Messages are
+ * stored compressed under the resource's data dir, next to flags.db, and the least
+ * recently used ones are removed when the cache grows past its size budget.
+ * Recently inserted or read messages are also kept in memory.
+ */
+class MessageCache {
+public:
+  MessageCache( const QString &identifier, qint64 maxSize );
+  ~MessageCache();
+
+  void setMaxSize( qint64 maxSize );
+
+  /**
+   * Returns the encoded message for @p sha1, or an empty byte array if it's not cached.
+   */
+  QByteArray message( const QString &sha1 );
+
+  /**
+   * Returns whether @p sha1 is cached, without counting it as a use.
+   */
+  bool contains( const QString &sha1 ) const;
+
+  void insert( const QString &sha1, const QByteArray &encodedMessage );
+
+  void clear();
+
+private:
+  class Private;
+  Private *const d;
+};
+
+#endif
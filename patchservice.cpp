@@ -0,0 +1,106 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "patchservice.h"
+#include "gitjob.h"
+#include "gitthread.h"
+
+#include <akonadi/dbusconnectionpool.h>
+
+#include <KDebug>
+#include <KLocale>
+#include <KStandardDirs>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QRegExp>
+
+enum {
+  PatchLifetime = 30 // minutes a patch file is kept for whoever asked for it
+};
+
+PatchService::PatchService( GitThread *worker, const QString &identifier,
+                            QObject *parent ) : QObject( parent )
+                                              , m_worker( worker )
+{
+  m_directory = KStandardDirs::locateLocal( "data", identifier + QLatin1String( "/patches/" ) );
+
+  // Whoever asked for them had their chance, don't let them pile up
+  QDir dir( m_directory );
+  foreach( const QString &file, dir.entryList( QDir::Files ) )
+    dir.remove( file );
+}
+
+void PatchService::removeExpiredPatches()
+{
+  const QDateTime expiry = QDateTime::currentDateTime().addSecs( -PatchLifetime * 60 );
+  QDir dir( m_directory );
+  foreach( const QFileInfo &info, dir.entryInfoList( QDir::Files ) ) {
+    if ( info.lastModified() < expiry )
+      dir.remove( info.fileName() );
+  }
+}
+
+QString PatchService::patchFileName( const QString &sha1 ) const
+{
+  return m_directory + sha1 + QLatin1String( ".patch" );
+}
+
+QString PatchService::fullPatch( const QString &sha1 )
+{
+  if ( !QRegExp( QLatin1String( "[0-9a-f]{40}" ) ).exactMatch( sha1 ) ) {
+    sendErrorReply( QDBusError::InvalidArgs, i18n( "Invalid commit: %1", sha1 ) );
+    return QString();
+  }
+
+  // Patches can be hundreds of MiB, a long running resource can't keep them all
+  removeExpiredPatches();
+
+  const QString fileName = patchFileName( sha1 );
+  if ( QFile::exists( fileName ) )
+    return fileName;
+
+  GitJob *job = new GitJob( GitJob::FullPatch, sha1, this );
+  job->setFileName( fileName );
+  connect( job, SIGNAL(finished()), SLOT(handleFullPatchFinished()) );
+
+  setDelayedReply( true );
+  m_pendingReplies.insert( job, message() );
+  m_worker->enqueue( job );
+  return QString();
+}
+
+void PatchService::handleFullPatchFinished()
+{
+  GitJob *job = qobject_cast<GitJob*>( sender() );
+  Q_ASSERT( job );
+
+  const QDBusMessage request = m_pendingReplies.take( job );
+  if ( job->lastErrorCode() == GitJob::ResultSuccess ) {
+    Akonadi::DBusConnectionPool::threadConnection().send( request.createReply( job->fileName() ) );
+  } else {
+    kWarning() << "Full patch failed for" << job->sha1() << job->lastErrorString();
+    Akonadi::DBusConnectionPool::threadConnection().send( request.createErrorReply( QDBusError::Failed, job->lastErrorString() ) );
+  }
+
+  job->deleteLater();
+}
@@ -0,0 +1,65 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#ifndef PATCHSERVICE_H_
+#define PATCHSERVICE_H_
+
+#include <QDBusContext>
+#include <QDBusMessage>
+#include <QHash>
+#include <QObject>
+#include <QString>
+
+class GitJob;
+class GitThread;
+
+/**
+ * Exported at /Patches. Hands out the whole patch of a commit, which messages
+ * only show up to the configured diff budget.
+ *
+ * Patches are rendered by the worker into files under the resource's data dir,
+ * so big ones never go over the bus. They're removed after half an hour, and
+ * when the resource starts.
+ */
+class PatchService : public QObject, protected QDBusContext {
+  Q_OBJECT
+  Q_CLASSINFO( "D-Bus Interface", "org.kde.Akonadi.Git.Patches" )
+public:
+  PatchService( GitThread *worker, const QString &identifier, QObject *parent = 0 );
+
+public Q_SLOTS:
+  /**
+   * Returns the path of a file with the full patch of commit @p sha1.
+   */
+  Q_SCRIPTABLE QString fullPatch( const QString &sha1 );
+
+private Q_SLOTS:
+  void handleFullPatchFinished();
+
+private:
+  QString patchFileName( const QString &sha1 ) const;
+  void removeExpiredPatches();
+
+  GitThread *m_worker;
+  QString m_directory;
+  QHash<GitJob*,QDBusMessage> m_pendingReplies;
+};
+
+#endif
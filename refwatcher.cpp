@@ -0,0 +1,89 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "refwatcher.h"
+
+#include <KDebug>
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFileSystemWatcher>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+
+RefWatcher::RefWatcher( QObject *parent ) : QObject( parent )
+                                          , m_watcher( 0 )
+                                          , m_debounceTimer( new QTimer( this ) )
+{
+  m_debounceTimer->setSingleShot( true );
+  m_debounceTimer->setInterval( DebounceInterval );
+  connect( m_debounceTimer, SIGNAL(timeout()), SIGNAL(refsChanged()) );
+}
+
+void RefWatcher::setGitDir( const QString &gitDir )
+{
+  m_gitDir = gitDir;
+  m_debounceTimer->stop();
+
+  // Start from scratch, the old repository's paths are of no use
+  delete m_watcher;
+  m_watcher = new QFileSystemWatcher( this );
+  connect( m_watcher, SIGNAL(directoryChanged(QString)), SLOT(handlePathChanged()) );
+  connect( m_watcher, SIGNAL(fileChanged(QString)), SLOT(handlePathChanged()) );
+  arm();
+}
+
+void RefWatcher::arm()
+{
+  if ( m_gitDir.isEmpty() )
+    return;
+
+  QStringList wanted;
+  wanted << m_gitDir
+         << m_gitDir + QLatin1String( "/refs/remotes" );
+
+  const QString originPath = m_gitDir + QLatin1String( "/refs/remotes/origin" );
+  if ( QFile::exists( originPath ) ) {
+    // Branches like KDE/4.10 live in subdirectories
+    wanted << originPath;
+    QDirIterator it( originPath, QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories );
+    while ( it.hasNext() )
+      wanted << it.next();
+  }
+
+  // Watches on renamed or removed paths are dropped, add them back once they reappear
+  const QSet<QString> watched = ( m_watcher->directories() + m_watcher->files() ).toSet();
+  QStringList missing;
+  foreach( const QString &path, wanted ) {
+    if ( !watched.contains( path ) && QFile::exists( path ) )
+      missing << path;
+  }
+
+  if ( !missing.isEmpty() ) {
+    kDebug() << "Watching" << missing;
+    m_watcher->addPaths( missing );
+  }
+}
+
+void RefWatcher::handlePathChanged()
+{
+  arm();
+  m_debounceTimer->start();
+}
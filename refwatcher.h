@@ -0,0 +1,69 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef REFWATCHER_H_
+#define REFWATCHER_H_
+
+#include <QObject>
+#include <QString>
+
+class QFileSystemWatcher;
+class QTimer;
+
+/**
+ * Tells when origin's refs might have changed.
+ *
+ * git never writes a ref in place, it writes a lock file and renames it over the
+ * old one, and git pack-refs deletes loose refs, so watching ref files loses the
+ * watch after the first change. Instead the directories holding the refs are
+ * watched, and the git dir itself, which is where packed-refs gets renamed into.
+ * New subdirectories are watched as they appear.
+ *
+ * Bursts of changes, like the ones from a fetch, are coalesced into a single
+ * refsChanged() emitted once things are quiet for DebounceInterval ms.
+ */
+class RefWatcher : public QObject {
+  Q_OBJECT
+public:
+  enum {
+    DebounceInterval = 500 // ms
+  };
+
+  explicit RefWatcher( QObject *parent = 0 );
+
+  /**
+   * Starts watching the given .git directory. An empty path stops watching.
+   */
+  void setGitDir( const QString &gitDir );
+
+Q_SIGNALS:
+  void refsChanged();
+
+private Q_SLOTS:
+  void handlePathChanged();
+
+private:
+  void arm();
+
+  QString m_gitDir;
+  QFileSystemWatcher *m_watcher;
+  QTimer *m_debounceTimer;
+};
+
+#endif
@@ -0,0 +1,427 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#include "remotefetcher.h"
+#include "cheatingutils.h"
+
+#include <KDebug>
+#include <KLocale>
+#include <KSaveFile>
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QProcess>
+#include <QRegExp>
+#include <QSet>
+
+#ifdef Q_OS_UNIX
+# include <errno.h>
+# include <fcntl.h>
+# include <string.h>
+# include <sys/file.h>
+# include <unistd.h>
+#endif
+
+#include <git2/errors.h>
+#include <git2/refs.h>
+#include <git2/remote.h>
+
+namespace {
+  // Held while fetching, so resources sharing the repository don't fetch at the same time.
+  // flock() locks are released by the kernel if we crash, unlike git's own .lock files.
+  class FetchLock {
+  public:
+    explicit FetchLock( const QString &gitDir ) : m_fd( -1 )
+    {
+#ifdef Q_OS_UNIX
+      const QByteArray path = QFile::encodeName( gitDir + QLatin1String( "/akonadi-fetch.lock" ) );
+      m_fd = ::open( path.constData(), O_RDWR | O_CREAT, 0644 );
+      if ( m_fd == -1 )
+        kWarning() << "Can't open fetch lock" << path << strerror( errno );
+#else
+      Q_UNUSED( gitDir );
+#endif
+    }
+
+    ~FetchLock()
+    {
+#ifdef Q_OS_UNIX
+      if ( m_fd != -1 )
+        ::close( m_fd ); // Releases the lock
+#endif
+    }
+
+    // Waits for whoever is fetching, returns false if cancelled meanwhile
+    bool acquire( const QAtomicInt *cancel )
+    {
+#ifdef Q_OS_UNIX
+      if ( m_fd == -1 )
+        return true; // Better fetching unsynchronized than not at all
+      while ( ::flock( m_fd, LOCK_EX | LOCK_NB ) == -1 ) {
+        if ( errno != EWOULDBLOCK && errno != EINTR ) {
+          kWarning() << "Can't lock for fetching" << strerror( errno );
+          return true;
+        }
+        if ( cancel && *cancel != 0 )
+          return false;
+        usleep( 100 * 1000 );
+      }
+#else
+      Q_UNUSED( cancel );
+#endif
+      return true;
+    }
+
+  private:
+    int m_fd;
+  };
+}
+
+static QString lastGitError( const QString &what )
+{
+  const git_error *error = giterr_last();
+  return error ? what + QLatin1String( ": " ) + QString::fromUtf8( error->message ) : what;
+}
+
+// libgit2 can do http(s), git:// and local paths, but ssh only when built with libssh2
+static bool needsGit( const char *url )
+{
+  const QString urlString = QString::fromUtf8( url );
+  if ( urlString.startsWith( QLatin1String( "ssh://" ) ) || urlString.startsWith( QLatin1String( "git+ssh://" ) ) )
+    return true;
+
+  // scp like syntax, user@host:path
+  const int colon = urlString.indexOf( QLatin1Char( ':' ) );
+  if ( colon > 1 && !urlString.contains( QLatin1String( "://" ) ) &&
+       urlString.lastIndexOf( QLatin1Char( '/' ), colon ) == -1 )
+    return true;
+
+  return !git_remote_supported_url( url );
+}
+
+static QStringList matchingBranches( const QStringList &branches, const QStringList &patterns )
+{
+  QList<QRegExp> regExps;
+  foreach( const QString &pattern, patterns )
+    regExps << QRegExp( pattern, Qt::CaseSensitive, QRegExp::Wildcard );
+
+  QStringList matching;
+  foreach( const QString &branch, branches ) {
+    foreach( const QRegExp &regExp, regExps ) {
+      if ( regExp.exactMatch( branch ) ) {
+        matching << branch;
+        break;
+      }
+    }
+  }
+  return matching;
+}
+
+static int collectHead( git_remote_head *head, void *payload )
+{
+  const QByteArray name( head->name );
+  if ( name.startsWith( "refs/heads/" ) )
+    static_cast<QStringList*>( payload )->append( QString::fromUtf8( name.mid( 11 ) ) );
+  return 0;
+}
+
+RemoteFetcher::RemoteFetcher( git_repository *repository, const QString &gitDir,
+                              const QAtomicInt *cancel, QObject *parent ) : QObject( parent )
+                                                                          , m_repository( repository )
+                                                                          , m_gitDir( gitDir )
+                                                                          , m_cancel( cancel )
+                                                                          , m_freshness( 0 )
+                                                                          , m_branchIndex( 0 )
+                                                                          , m_branchCount( 0 )
+                                                                          , m_percent( -1 )
+{
+}
+
+void RemoteFetcher::setFreshness( int seconds )
+{
+  m_freshness = seconds;
+}
+
+QString RemoteFetcher::refSpec( const QString &branch )
+{
+  return QLatin1String( "+refs/heads/" ) + branch + QLatin1String( ":refs/remotes/origin/" ) + branch;
+}
+
+bool RemoteFetcher::fetch( const QStringList &patterns )
+{
+  m_errorString.clear();
+  if ( patterns.isEmpty() )
+    return true;
+
+  FetchLock lock( m_gitDir );
+  if ( !lock.acquire( m_cancel ) ) {
+    m_errorString = i18n( "Fetch cancelled" );
+    return false;
+  }
+
+  if ( isFresh( patterns ) ) {
+    kDebug() << "Another resource just fetched" << patterns << ", not fetching again";
+    setPercent( 100 );
+    return true;
+  }
+
+  git_remote *remote = 0;
+  if ( git_remote_load( &remote, m_repository, "origin" ) != GIT_OK ) {
+    m_errorString = lastGitError( QLatin1String( "git_remote_load error" ) );
+    return false;
+  }
+
+  // What's there now, not what was there at the last fetch
+  QStringList remoteBranches;
+  bool result;
+  if ( needsGit( git_remote_url( remote ) ) ) {
+    kDebug() << "Transport not supported by libgit2, using git for" << git_remote_url( remote );
+    result = listWithGit( &remoteBranches ) &&
+             fetchWithGit( matchingBranches( remoteBranches, patterns ) );
+  } else {
+    result = listInProcess( remote, &remoteBranches ) &&
+             fetchInProcess( remote, matchingBranches( remoteBranches, patterns ) );
+  }
+
+  git_remote_free( remote );
+
+  if ( result ) {
+    prune( remoteBranches, patterns );
+    writeStamp( patterns );
+  }
+  return result;
+}
+
+bool RemoteFetcher::listInProcess( git_remote *remote, QStringList *branches )
+{
+  if ( git_remote_connect( remote, GIT_DIRECTION_FETCH ) != GIT_OK ) {
+    m_errorString = lastGitError( QLatin1String( "git_remote_connect error" ) );
+    return false;
+  }
+
+  const int error = git_remote_ls( remote, collectHead, branches );
+  git_remote_disconnect( remote );
+  if ( error != GIT_OK ) {
+    m_errorString = lastGitError( QLatin1String( "git_remote_ls error" ) );
+    return false;
+  }
+  return true;
+}
+
+bool RemoteFetcher::listWithGit( QStringList *branches )
+{
+  QByteArray output;
+  if ( !runGit( QStringList() << QLatin1String( "ls-remote" ) << QLatin1String( "--heads" )
+                              << QLatin1String( "origin" ), &output ) )
+    return false;
+
+  // <sha1> TAB refs/heads/<branch>
+  foreach( const QByteArray &line, output.split( '\n' ) ) {
+    const int prefix = line.indexOf( "\trefs/heads/" );
+    if ( prefix != -1 )
+      branches->append( QString::fromUtf8( line.mid( prefix + 12 ) ) );
+  }
+  return true;
+}
+
+bool RemoteFetcher::fetchInProcess( git_remote *remote, const QStringList &branches )
+{
+  git_remote_set_autotag( remote, GIT_REMOTE_DOWNLOAD_TAGS_NONE );
+
+  // libgit2 0.19 takes a single fetch refspec, so fetch one branch at a time. The
+  // tips of the previous branches are already updated, so they're negotiated as
+  // haves and shared history isn't transferred twice.
+  m_branchCount = branches.count();
+  if ( m_branchCount == 0 ) {
+    setPercent( 100 );
+    return true;
+  }
+  for ( m_branchIndex = 0; m_branchIndex < m_branchCount; ++m_branchIndex ) {
+    const QByteArray spec = refSpec( branches.at( m_branchIndex ) ).toUtf8();
+    if ( git_remote_set_fetchspec( remote, spec.constData() ) != GIT_OK ) {
+      m_errorString = lastGitError( QLatin1String( "git_remote_set_fetchspec error" ) );
+      return false;
+    }
+
+    if ( git_remote_connect( remote, GIT_DIRECTION_FETCH ) != GIT_OK ) {
+      m_errorString = lastGitError( QLatin1String( "git_remote_connect error" ) );
+      return false;
+    }
+
+    const int error = git_remote_download( remote, &RemoteFetcher::transferProgress, this );
+    git_remote_disconnect( remote );
+    if ( isCancelled() ) {
+      m_errorString = i18n( "Fetch cancelled" );
+      return false;
+    } else if ( error != GIT_OK ) {
+      m_errorString = lastGitError( QLatin1String( "git_remote_download error" ) );
+      return false;
+    }
+
+    if ( git_remote_update_tips( remote ) != GIT_OK ) {
+      m_errorString = lastGitError( QLatin1String( "git_remote_update_tips error" ) );
+      return false;
+    }
+  }
+
+  setPercent( 100 );
+  return true;
+}
+
+bool RemoteFetcher::fetchWithGit( const QStringList &branches )
+{
+  // Without refspecs git would fetch the remote's configured ones
+  if ( branches.isEmpty() )
+    return true;
+
+  QStringList arguments;
+  arguments << QLatin1String( "fetch" ) << QLatin1String( "--no-tags" ) << QLatin1String( "origin" );
+  foreach( const QString &branch, branches )
+    arguments << refSpec( branch );
+  return runGit( arguments );
+}
+
+bool RemoteFetcher::runGit( const QStringList &arguments, QByteArray *output )
+{
+  QProcess process;
+  // The git dir's parent is the work tree
+  process.setWorkingDirectory( QDir( m_gitDir ).absoluteFilePath( QLatin1String( ".." ) ) );
+  process.start( QLatin1String( "git" ), arguments );
+  if ( !process.waitForStarted() ) {
+    m_errorString = i18n( "Error starting git %1: %2", arguments.first(), process.errorString() );
+    return false;
+  }
+
+  // No timeout, big fetches take as long as they take, but stay cancellable
+  while ( !process.waitForFinished( 100 ) ) {
+    if ( process.state() == QProcess::NotRunning )
+      break;
+    if ( isCancelled() ) {
+      process.kill();
+      process.waitForFinished();
+      m_errorString = i18n( "Fetch cancelled" );
+      return false;
+    }
+  }
+
+  if ( process.exitStatus() != QProcess::NormalExit || process.exitCode() != 0 ) {
+    m_errorString = i18n( "Error doing git %1: %2", arguments.first(),
+                          QString::fromLocal8Bit( process.readAllStandardError() ) );
+    return false;
+  }
+  if ( output )
+    *output = process.readAllStandardOutput();
+  return true;
+}
+
+void RemoteFetcher::prune( const QStringList &remoteBranches, const QStringList &patterns )
+{
+  // Like git fetch --prune, but only for the branches we fetch
+  const QSet<QString> existing = remoteBranches.toSet();
+  foreach( const QString &branch, matchingBranches( CheatingUtils::remoteBranches( m_gitDir ), patterns ) ) {
+    if ( existing.contains( branch ) )
+      continue;
+
+    git_reference *ref = 0;
+    const QByteArray name = ( QLatin1String( "refs/remotes/origin/" ) + branch ).toUtf8();
+    if ( git_reference_lookup( &ref, m_repository, name.constData() ) != GIT_OK )
+      continue;
+    kDebug() << "Pruning" << branch << ", it's gone from origin";
+    if ( git_reference_delete( ref ) != GIT_OK )
+      kWarning() << lastGitError( QLatin1String( "git_reference_delete error" ) );
+    git_reference_free( ref );
+  }
+}
+
+int RemoteFetcher::transferProgress( const git_transfer_progress *stats, void *payload )
+{
+  RemoteFetcher *fetcher = static_cast<RemoteFetcher*>( payload );
+  if ( fetcher->isCancelled() )
+    return -1;
+
+  // Receiving and indexing count half each
+  int branchPercent = 0;
+  if ( stats->total_objects > 0 )
+    branchPercent = ( stats->received_objects + stats->indexed_objects ) * 50 / stats->total_objects;
+
+  fetcher->setPercent( ( fetcher->m_branchIndex * 100 + branchPercent ) / fetcher->m_branchCount );
+  return 0;
+}
+
+void RemoteFetcher::setPercent( int percent )
+{
+  if ( percent != m_percent ) {
+    m_percent = percent;
+    emit progress( percent );
+  }
+}
+
+bool RemoteFetcher::isCancelled() const
+{
+  return m_cancel && *m_cancel != 0;
+}
+
+QString RemoteFetcher::stampFileName() const
+{
+  return m_gitDir + QLatin1String( "/akonadi-fetch.stamp" );
+}
+
+bool RemoteFetcher::isFresh( const QStringList &patterns ) const
+{
+  if ( m_freshness <= 0 )
+    return false;
+
+  const QFileInfo info( stampFileName() );
+  if ( !info.exists() || info.lastModified().secsTo( QDateTime::currentDateTime() ) >= m_freshness )
+    return false;
+
+  QFile file( info.filePath() );
+  if ( !file.open( QIODevice::ReadOnly | QIODevice::Text ) )
+    return false;
+
+  QSet<QString> fetched;
+  while ( !file.atEnd() )
+    fetched.insert( QString::fromUtf8( file.readLine() ).trimmed() );
+
+  foreach( const QString &pattern, patterns ) {
+    if ( !fetched.contains( pattern ) )
+      return false;
+  }
+  return true;
+}
+
+void RemoteFetcher::writeStamp( const QStringList &patterns )
+{
+  KSaveFile file( stampFileName() );
+  if ( !file.open() ) {
+    kWarning() << "Can't write" << stampFileName() << file.errorString();
+    return;
+  }
+  foreach( const QString &pattern, patterns )
+    file.write( pattern.toUtf8() + '\n' );
+  if ( !file.finalize() )
+    kWarning() << "Can't write" << stampFileName() << file.errorString();
+}
+
+QString RemoteFetcher::errorString() const
+{
+  return m_errorString;
+}
@@ -0,0 +1,96 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+#ifndef REMOTE_FETCHER_H_
+#define REMOTE_FETCHER_H_
+
+#include <QAtomicInt>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+
+#include <git2/types.h>
+
+/**
+ * Fetches the branches of origin matching the given wildcard patterns in-process,
+ * with libgit2.
+ *
+ * The remote's heads are listed first, so branches created upstream are fetched
+ * too and branches deleted upstream are removed from refs/remotes/origin/. Only
+ * refs/heads/<branch> is fetched into refs/remotes/origin/<branch>, tags aren't,
+ * so a fetch only transfers what the resource will walk. Transports libgit2 can't
+ * handle ( ssh, mostly ) fall back to a git subprocess with the same refspecs.
+ *
+ * Setting the cancel flag from another thread aborts the transfer the next
+ * time data arrives.
+ *
+ * Resources sharing a repository fetch one at a time, serialized by a lock file
+ * in the git dir. After a successful fetch a stamp file records which patterns
+ * were fetched, and a fetch for patterns covered by a stamp younger than the
+ * freshness window is skipped, reusing the other resource's result.
+ */
+class RemoteFetcher : public QObject {
+  Q_OBJECT
+public:
+  RemoteFetcher( git_repository *repository, const QString &gitDir,
+                 const QAtomicInt *cancel, QObject *parent = 0 );
+
+  /**
+   * Skip fetching if another resource fetched the same patterns less than
+   * @p seconds ago. 0, the default, always fetches.
+   */
+  void setFreshness( int seconds );
+
+  bool fetch( const QStringList &patterns );
+
+  QString errorString() const;
+
+  static QString refSpec( const QString &branch );
+
+Q_SIGNALS:
+  /**
+   * Emitted whenever the overall percentage changes.
+   */
+  void progress( int percent );
+
+private:
+  static int transferProgress( const git_transfer_progress *stats, void *payload );
+  bool listInProcess( git_remote *remote, QStringList *branches );
+  bool listWithGit( QStringList *branches );
+  bool fetchInProcess( git_remote *remote, const QStringList &branches );
+  bool fetchWithGit( const QStringList &branches );
+  bool runGit( const QStringList &arguments, QByteArray *output = 0 );
+  void prune( const QStringList &remoteBranches, const QStringList &patterns );
+  void setPercent( int percent );
+  bool isCancelled() const;
+  QString stampFileName() const;
+  bool isFresh( const QStringList &patterns ) const;
+  void writeStamp( const QStringList &patterns );
+
+  git_repository *m_repository;
+  const QString m_gitDir;
+  const QAtomicInt *m_cancel;
+  QString m_errorString;
+  int m_freshness;
+  int m_branchIndex;
+  int m_branchCount;
+  int m_percent;
+};
+
+#endif
@@ -0,0 +1,119 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#include "statistics.h"
+
+#include <QtAlgorithms>
+
+static const char *const PhaseNames[] = {
+  "fetch", "walk", "render", "conversion", "flagLookup", "delivery"
+};
+
+Statistics::Statistics( QObject *parent ) : QObject( parent )
+{
+  reset();
+}
+
+void Statistics::addDuration( Phase phase, qint64 msecs )
+{
+  Q_ASSERT( phase >= 0 && phase < PhaseCount );
+  PhaseTimes &times = m_phases[phase];
+  times.last = msecs;
+  times.total += msecs;
+  times.max = qMax( times.max, msecs );
+  ++times.count;
+}
+
+void Statistics::addCommits( int count )
+{
+  m_commits += count;
+}
+
+void Statistics::addItems( int count )
+{
+  m_items += count;
+}
+
+void Statistics::addRenderedBytes( qint64 bytes )
+{
+  m_renderedBytes += bytes;
+}
+
+void Statistics::addCacheLookup( bool hit )
+{
+  if ( hit )
+    ++m_cacheHits;
+  else
+    ++m_cacheMisses;
+}
+
+void Statistics::addRetrieveLatency( qint64 msecs )
+{
+  if ( m_latencies.count() < LatencySamples )
+    m_latencies.append( msecs );
+  else
+    m_latencies[m_retrieveCount % LatencySamples] = msecs;
+  ++m_retrieveCount;
+}
+
+QVariantMap Statistics::statistics() const
+{
+  QVariantMap result;
+  for ( int i = 0; i < PhaseCount; ++i ) {
+    const QString prefix = QLatin1String( PhaseNames[i] ) + QLatin1Char( '.' );
+    result.insert( prefix + QLatin1String( "count" ), m_phases[i].count );
+    result.insert( prefix + QLatin1String( "lastMs" ), m_phases[i].last );
+    result.insert( prefix + QLatin1String( "totalMs" ), m_phases[i].total );
+    result.insert( prefix + QLatin1String( "maxMs" ), m_phases[i].max );
+  }
+
+  result.insert( QLatin1String( "commits" ), m_commits );
+  result.insert( QLatin1String( "items" ), m_items );
+  result.insert( QLatin1String( "renderedBytes" ), m_renderedBytes );
+
+  const qint64 lookups = m_cacheHits + m_cacheMisses;
+  result.insert( QLatin1String( "messageCache.hits" ), m_cacheHits );
+  result.insert( QLatin1String( "messageCache.misses" ), m_cacheMisses );
+  result.insert( QLatin1String( "messageCache.hitRate" ), lookups ? double( m_cacheHits ) / lookups : 0.0 );
+
+  QVector<qint64> latencies = m_latencies;
+  qSort( latencies );
+  const int samples = latencies.count();
+  result.insert( QLatin1String( "retrieveItem.count" ), m_retrieveCount );
+  result.insert( QLatin1String( "retrieveItem.samples" ), samples );
+  result.insert( QLatin1String( "retrieveItem.p50Ms" ), samples ? latencies.at( samples * 50 / 100 ) : 0 );
+  result.insert( QLatin1String( "retrieveItem.p90Ms" ), samples ? latencies.at( samples * 90 / 100 ) : 0 );
+  result.insert( QLatin1String( "retrieveItem.p99Ms" ), samples ? latencies.at( samples * 99 / 100 ) : 0 );
+  result.insert( QLatin1String( "retrieveItem.maxMs" ), samples ? latencies.last() : 0 );
+  return result;
+}
+
+void Statistics::reset()
+{
+  for ( int i = 0; i < PhaseCount; ++i )
+    m_phases[i] = PhaseTimes();
+  m_commits = 0;
+  m_items = 0;
+  m_renderedBytes = 0;
+  m_cacheHits = 0;
+  m_cacheMisses = 0;
+  m_retrieveCount = 0;
+  m_latencies.clear();
+}
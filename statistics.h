@@ -0,0 +1,90 @@
+/*
+    Copyright (c) 2012 Sérgio Martins <iamsergio@gmail.com>
+
+    This library is free software; you can redistribute it and/or modify it
+    under the terms of the GNU Library General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or (at your
+    option) any later version.
+
+    This library is distributed in the hope that it will be useful, but WITHOUT
+    ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+    FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Library General Public
+    License for more details.
+
+    You should have received a copy of the GNU Library General Public License
+    along with this library; see the file COPYING.LIB.  If not, write to the
+    Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301, USA.
+*/
+
+
+#ifndef STATISTICS_H_
+#define STATISTICS_H_
+
+#include <QObject>
+#include <QVariantMap>
+#include <QVector>
+
+/**
+ * Exported at /Statistics. Where the time of syncs and retrievals goes, for
+ * monitoring to poll.
+ *
+ * Everything is counted since the resource started or since reset(). Durations
+ * are in ms. The retrieveItem() latency percentiles are over the last
+ * LatencySamples calls.
+ */
+class Statistics : public QObject {
+  Q_OBJECT
+  Q_CLASSINFO( "D-Bus Interface", "org.kde.Akonadi.Git.Statistics" )
+public:
+  enum Phase {
+    Fetch,      // fetching from origin, in the worker
+    Walk,       // walking the history for a listing, in the worker
+    Render,     // rendering messages, requested and prefetched, in the worker
+    Conversion, // turning walked commits into items, flag lookups included
+    FlagLookup, // looking up the flags of items
+    Delivery,   // handing items to Akonadi
+    PhaseCount
+  };
+
+  enum {
+    LatencySamples = 256
+  };
+
+  explicit Statistics( QObject *parent = 0 );
+
+  void addDuration( Phase phase, qint64 msecs );
+  void addCommits( int count );
+  void addItems( int count );
+  void addRenderedBytes( qint64 bytes );
+  void addCacheLookup( bool hit );
+  void addRetrieveLatency( qint64 msecs );
+
+public Q_SLOTS:
+  /**
+   * Everything, keyed like "walk.totalMs", "items" or "retrieveItem.p90Ms".
+   */
+  Q_SCRIPTABLE QVariantMap statistics() const;
+
+  Q_SCRIPTABLE void reset();
+
+private:
+  struct PhaseTimes {
+    PhaseTimes() : last( 0 ), total( 0 ), max( 0 ), count( 0 ) {}
+    qint64 last;
+    qint64 total;
+    qint64 max;
+    qint64 count;
+  };
+
+  PhaseTimes m_phases[PhaseCount];
+  qint64 m_commits;
+  qint64 m_items;
+  qint64 m_renderedBytes;
+  qint64 m_cacheHits;
+  qint64 m_cacheMisses;
+  qint64 m_retrieveCount;
+  QVector<qint64> m_latencies; // ring buffer, m_retrieveCount % LatencySamples is next
+};
+
+#endif